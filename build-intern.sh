@@ -3,7 +3,7 @@
 # put the path to your FLTK repository here
 fltk=../fltk
 
-targets="animgifimage animgifimage-simple animgifimage-resize animgifimage-play buttons pixmap"
+targets="animgifimage animgifimage-simple animgifimage-resize animgifimage-play animgifimage-bench lzw-bench buttons pixmap"
 src=intern
 #opt=-pg
 
@@ -22,6 +22,7 @@ fi
 if [ "$1" = "all" ]; then
 	cp -av $src/FL/*.H $fltk/FL/.
 	cp -av $src/src/*.cxx $fltk/src/.
+	cp -av $src/src/*.H $fltk/src/.
 # uncomment for newer FLTK version using image reader class
 #	cp -av $src/FL/v2/*.H $fltk/FL/.
 #	cp -av $src/src/v2/*.cxx $fltk/src/.
@@ -30,13 +30,40 @@
 #include <FL/Fl_Shared_Image.H>
 #include <FL/Fl.H>
 #include <FL/fl_utf8.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
+#define GIF_LAXV 1 // signature version is checked in load()
 #include "gif_load.h"
 
 //
 //  Helper classes/definitions
 //
 
+//
+// Read-only view of the contents of a GIF file.
+// Where possible the file is memory mapped and passed to the decoder
+// as is, otherwise it is read into a heap buffer.
+//
+class GifInput {
+public:
+  GifInput() : _data(0), _size(0), _mapped(false) {}
+  ~GifInput() { close(); }
+  bool open(const char *name_);
+  void close();
+  const uchar *data() const { return _data; }
+  long size() const { return _size; }
+private:
+  GifInput(const GifInput&);
+  GifInput& operator=(const GifInput&);
+  const uchar *_data;               // file contents
+  long _size;                       // size of file contents
+  bool _mapped;                     // flag if _data is a memory mapping
+};
+
 class Fl_Anim_GIF::FrameInfo {
 friend class Fl_Anim_GIF;
 
@@ -100,17 +127,29 @@ friend class Fl_Anim_GIF;
     scaling((Fl_RGB_Scaling)0),
     _debug(0),
     optimize_mem(false),
-    offscreen(0) {}
+    offscreen(0),
+    shown(0),
+    shown_w(0),
+    shown_h(0),
+    shown_frame(-1),
+    shown_rgb(0),
+    under(0),
+    under_x(0),
+    under_y(0),
+    under_w(0),
+    under_h(0),
+    under_alloc(0) {}
   ~FrameInfo();
   void clear();
   void copy(const FrameInfo& fi_);
   double convertDelay(int d_) const;
   int debug() const { return _debug; }
-  bool load(char *buf_, long len_);
+  bool load(const uchar *buf_, long len_);
   bool push_back_frame(const GifFrame &frame_);
   void resize(int W_, int H_);
   void scale_frame(int frame_);
   void set_frame(int frame_);
+  Fl_RGB_Image *show(int frame_);
 private:
   Fl_Anim_GIF *_anim;               // a pointer to the Widget (only needed for name())
   bool valid;                       // flag if valid data
@@ -130,6 +169,13 @@ private:
   int _debug;                       // Flag for debug outputs
   bool optimize_mem;                // Flag to store frames in original dimensions
   uchar *offscreen;                 // internal "offscreen" buffer
+  uchar *shown;                     // image drawn by draw() with optimize_mem (see show())
+  int shown_w, shown_h;             // dimensions of 'shown'
+  int shown_frame;                  // frame in 'shown' (-1: none)
+  Fl_RGB_Image *shown_rgb;          // image of 'shown'
+  uchar *under;                     // area of 'shown' under 'shown_frame' (if disposed)
+  int under_x, under_y, under_w, under_h; // position and dimensions of 'under'
+  size_t under_alloc;               // allocated size of 'under'
 private:
   static void cb_gl_frame(void *ctx_, GIF_WHDR *whdr_);
   static void cb_gl_extension(void *ctx_, GIF_WHDR *whdr_);
@@ -167,6 +213,16 @@ void Fl_Anim_GIF::FrameInfo::clear() {
   }
   delete[] offscreen;
   offscreen = 0;
+  delete shown_rgb;
+  shown_rgb = 0;
+  delete[] shown;
+  shown = 0;
+  shown_w = shown_h = 0;
+  shown_frame = -1;
+  delete[] under;
+  under = 0;
+  under_w = under_h = 0;
+  under_alloc = 0;
   free(frames);
   frames = 0;
   frames_size = 0;
@@ -232,24 +288,54 @@ void Fl_Anim_GIF::FrameInfo::copy(const FrameInfo& fi_) {
 }
 
 
-static void deinterlace(const GIF_WHDR &whdr_) {
-  if (!whdr_.intr) return;
-  // this code is from 'gif_load's example program (with adaptions)
-  int iter = 0;
-  int ddst = 0;
-  int ifin = 4;
-  size_t sz = whdr_.frxd * whdr_.fryd;
-  uchar *buf = new (std::nothrow) uchar[sz];
-  if (!buf) return;
-  memset(buf, whdr_.tran, sz);
-  for (int dsrc = -1; iter < ifin; iter++)
-    for (int yoff = 16 >> ((iter > 1) ? iter : 1), y = (8 >> iter) & 7;
-      y < whdr_.fryd; y += yoff)
-        for (int x = 0; x < whdr_.frxd; x++)
-          if (whdr_.tran != (int)whdr_.bptr[++dsrc])
-            buf[whdr_.frxd * y + x + ddst] = whdr_.bptr[dsrc];
-  memcpy(whdr_.bptr, buf, sz);
-  delete[] buf;
+static int interlaced_row(int y_, int h_) {
+  // Return the index of image row 'y_' in the pixel data of an
+  // interlaced frame with height 'h_'. The rows are stored in
+  // 4 passes: every 8th row from 0, every 8th from 4,
+  // every 4th from 2 and every 2nd from 1.
+  if (!(y_ & 7))
+    return y_ >> 3;
+  int row = (h_ + 7) >> 3;  // rows in pass 1
+  if (!(y_ & 3))
+    return row + (y_ >> 3);
+  row += (h_ + 3) >> 3;     // rows in pass 2
+  if (!(y_ & 1))
+    return row + (y_ >> 2);
+  row += (h_ + 1) >> 2;     // rows in pass 3
+  return row + (y_ >> 1);
+}
+
+
+static void draw_over(uchar *dst_, int dst_w_, int dst_h_,
+                      const Fl_RGB_Image *rgb_, int x_, int y_) {
+  // Draw the image 'rgb_' at 'x_/y_' over the RGBA image 'dst_'
+  // of size 'dst_w_' x 'dst_h_' (clipped, alpha blended).
+  int d = rgb_->d();
+  int ld = rgb_->ld() ? rgb_->ld() : rgb_->w() * d;
+  int w = x_ + rgb_->w() <= dst_w_ ? rgb_->w() : dst_w_ - x_;
+  int h = y_ + rgb_->h() <= dst_h_ ? rgb_->h() : dst_h_ - y_;
+  const uchar *src = (const uchar *)rgb_->data()[0];
+  for (int y = 0; y < h; y++) {
+    const uchar *s = src + (size_t)y * ld;
+    uchar *p = dst_ + ((size_t)(y_ + y) * dst_w_ + x_) * 4;
+    for (int x = 0; x < w; x++, s += d, p += 4) {
+      int a = d == 2 || d == 4 ? s[d - 1] : 0xff;
+      if (!a)
+        continue;
+      uchar c[3] = { s[0], d < 3 ? s[0] : s[1], d < 3 ? s[0] : s[2] }; // (gray if desaturated)
+      if (a == 0xff) {
+        memcpy(p, c, 3);
+        p[3] = 0xff;
+        continue;
+      }
+      // (partly transparent pixels come from scaling)
+      int pa = p[3] * (0xff - a) / 0xff;
+      int oa = a + pa;
+      for (int i = 0; i < 3; i++)
+        p[i] = (uchar)((c[i] * a + p[i] * pa) / oa);
+      p[3] = (uchar)oa;
+    }
+  }
 }
 
 
@@ -300,10 +386,11 @@ void Fl_Anim_GIF::FrameInfo::dispose(int frame_) {
 }
 
 
-bool Fl_Anim_GIF::FrameInfo::load(char *buf_, long len_) {
+bool Fl_Anim_GIF::FrameInfo::load(const uchar *buf_, long len_) {
   // decode GIF using gif_load.h
+  // Note: gif_load does not write to the input data
   valid = false;
-  GIF_Load(buf_, len_, cb_gl_frame, cb_gl_extension, this, 0);
+  GIF_Load((void *)buf_, len_, cb_gl_frame, cb_gl_extension, this, 0);
 
   delete[] offscreen;
   offscreen = 0;
@@ -351,8 +438,6 @@ void Fl_Anim_GIF::FrameInfo::onFrameLoaded(GIF_WHDR &whdr_) {
     }
   }
 
-  deinterlace(whdr_);
-
   if (!whdr_.ifrm) {
     // store background_color AFTER color table is set
     background_color_index = whdr_.clrs && whdr_.bkgd < whdr_.clrs ? whdr_.bkgd : -1;
@@ -386,9 +471,13 @@ void Fl_Anim_GIF::FrameInfo::onFrameLoaded(GIF_WHDR &whdr_) {
   dispose(frames_size - 1);
 
   // copy image data to offscreen
-  uchar *bits = whdr_.bptr;
+  // (interlaced rows are mapped to their image rows on the fly)
   uchar *endp = offscreen + canvas_w * canvas_h * 4;
   for (int y = frame.y; y < frame.y + frame.h; y++) {
+    int row = y - frame.y;
+    if (whdr_.intr)
+      row = interlaced_row(row, frame.h);
+    uchar *bits = whdr_.bptr + row * frame.w;
     for (int x = frame.x; x < frame.x + frame.w; x++) {
       uchar c = *bits++;
       if (c == whdr_.tran)
@@ -549,6 +638,86 @@ void Fl_Anim_GIF::FrameInfo::set_frame(int frame_) {
 }
 
 
+Fl_RGB_Image *Fl_Anim_GIF::FrameInfo::show(int frame_) {
+  // Bring the image 'shown' to frame 'frame_' as draw() shows it
+  // with optimize_mem: the frames since the last full canvas frame
+  // drawn over each other, except those disposed before 'frame_'.
+  // So the next frame just needs the area under the last frame
+  // restored, if that is disposed (saved before drawing it), and
+  // itself drawn over it, instead of drawing all these frames again.
+  // Returns 0 if a frame can't be drawn into it (see draw()).
+  if (shown_frame == frame_ && shown_rgb && shown_w == canvas_w && shown_h == canvas_h)
+    return shown_rgb;
+  int first = frame_;
+  while (first > 0 && !(frames[first].x == 0 && frames[first].y == 0 &&
+                        frames[first].w == canvas_w && frames[first].h == canvas_h))
+    first--;
+  if (shown && shown_w == canvas_w && shown_h == canvas_h &&
+      first < frame_ && shown_frame >= 0 && shown_frame == frame_ - 1) {
+    Dispose dispose = frames[shown_frame].dispose;
+    if (dispose == DISPOSE_BACKGROUND || dispose == DISPOSE_PREVIOUS) {
+      for (int y = 0; y < under_h; y++)
+        memcpy(shown + ((size_t)(under_y + y) * shown_w + under_x) * 4,
+               under + (size_t)y * under_w * 4, under_w * 4);
+    }
+    first = frame_;
+  }
+  else {
+    if (!shown || shown_w != canvas_w || shown_h != canvas_h) {
+      delete shown_rgb;
+      shown_rgb = 0;
+      delete[] shown;
+      shown_w = canvas_w;
+      shown_h = canvas_h;
+      shown = new (std::nothrow) uchar[(size_t)shown_w * shown_h * 4];
+      if (!shown) {
+        shown_w = shown_h = 0;
+        return 0;
+      }
+    }
+    memset(shown, 0, (size_t)shown_w * shown_h * 4);
+  }
+  shown_frame = -1; // (incomplete)
+  for (int f = first; f <= frame_; f++) {
+    bool disposed = frames[f].dispose == DISPOSE_BACKGROUND ||
+                    frames[f].dispose == DISPOSE_PREVIOUS;
+    if (f < frame_ && disposed)
+      continue;
+    set_frame(f); // (scaled, color averaged, ..)
+    const GifFrame &fr = frames[f];
+    if (!fr.rgb || fr.rgb->w() != fr.w || fr.rgb->h() != fr.h)
+      return 0; // (not scaled to its size, e.g. by a Fl_Shared_Image)
+    if (disposed) {
+      // save the area under the frame
+      under_x = fr.x;
+      under_y = fr.y;
+      under_w = fr.x + fr.w <= shown_w ? fr.w : shown_w - fr.x;
+      under_h = fr.y + fr.h <= shown_h ? fr.h : shown_h - fr.y;
+      if (under_w < 0) under_w = 0;
+      if (under_h < 0) under_h = 0;
+      size_t size = (size_t)under_w * under_h * 4;
+      if (size > under_alloc) {
+        delete[] under;
+        under = new (std::nothrow) uchar[size];
+        under_alloc = under ? size : 0;
+        if (!under)
+          return 0;
+      }
+      for (int y = 0; y < under_h; y++)
+        memcpy(under + (size_t)y * under_w * 4,
+               shown + ((size_t)(under_y + y) * shown_w + under_x) * 4, under_w * 4);
+    }
+    draw_over(shown, shown_w, shown_h, fr.rgb, fr.x, fr.y);
+  }
+  shown_frame = frame_;
+  if (!shown_rgb)
+    shown_rgb = new Fl_RGB_Image(shown, shown_w, shown_h, 4);
+  else
+    shown_rgb->uncache();
+  return shown_rgb;
+}
+
+
 //
 // Fl_Anim_GIF global variables
 //
@@ -569,11 +738,14 @@ bool Fl_Anim_GIF::loop = true;
 #include <FL/fl_draw.H>
 
 
-void Fl_Anim_GIF::_init(const char*name_, bool start_,
+void Fl_Anim_GIF::_init(const char*name_, const unsigned char *data_,
+                        size_t length_, bool start_,
                         bool optimize_mem_, int debug_) {
   _fi->_debug = debug_;
   _fi->optimize_mem = optimize_mem_;
-  if (name_)
+  if (data_)
+    _valid = load(name_, data_, length_);
+  else if (name_)
     _valid = load(name_);
   if (canvas_w() && canvas_h()) {
     if (w() <= 0 && h() <= 0)
@@ -598,7 +770,7 @@ Fl_Anim_GIF::Fl_Anim_GIF(int x_, int y_, int w_, int h_,
   _speed(1),
   _autoresize(false),
   _fi(new FrameInfo(this)) {
-    _init(name_, start_, optimize_mem_, debug_);
+    _init(name_, 0, 0, start_, optimize_mem_, debug_);
 }
 
 
@@ -616,7 +788,27 @@ Fl_Anim_GIF::Fl_Anim_GIF(int x_, int y_,
   _speed(1),
   _autoresize(false),
   _fi(new FrameInfo(this)) {
-    _init(name_, start_, optimize_mem_, debug_);
+    _init(name_, 0, 0, start_, optimize_mem_, debug_);
+}
+
+
+Fl_Anim_GIF::Fl_Anim_GIF(int x_, int y_, int w_, int h_,
+                         const char *imagename_,
+                         const unsigned char *data_,
+                         const size_t length_,
+                         bool start_ /* = true*/,
+                         bool optimize_mem_/* = false*/,
+                         int debug_/* = 0*/) :
+  Inherited(x_, y_, w_, h_),
+  _name(imagename_ ? strdup(imagename_) : 0),
+  _valid(false),
+  _uncache(false),
+  _stopped(false),
+  _frame(-1),
+  _speed(1),
+  _autoresize(false),
+  _fi(new FrameInfo(this)) {
+    _init(imagename_, data_, length_, start_, optimize_mem_, debug_);
 }
 
 
@@ -670,6 +862,7 @@ void Fl_Anim_GIF::cb_animate(void *d_) {
 
 /*virtual*/
 void Fl_Anim_GIF::color_average(Fl_Color c_, float i_) {
+  _fi->shown_frame = -1; // (draw the frames again)
   if (i_ < 0) {
     // immediate mode
     i_ = -i_;
@@ -726,6 +919,7 @@ void Fl_Anim_GIF::delay(int frame_, double delay_) {
 
 /*virtual*/
 void Fl_Anim_GIF::desaturate() {
+  _fi->shown_frame = -1; // (draw the frames again)
   _fi->desaturate = true;
 }
 
@@ -735,7 +929,12 @@ void Fl_Anim_GIF::draw() {
   if (this->image()) {
     int X = x() + (w() - canvas_w()) / 2;
     int Y = y() + (h() - canvas_h()) / 2;
-    if (_fi->optimize_mem) {
+    Fl_RGB_Image *shown = _fi->optimize_mem ? _fi->show(_frame) : 0;
+    if (shown) {
+      // (the frames since the last full canvas frame drawn over each other)
+      shown->draw(X, Y);
+    }
+    else if (_fi->optimize_mem) {
       int f0 = _frame;
       while (f0 > 0 && !(_fi->frames[f0].x == 0 && _fi->frames[f0].y == 0 &&
                          _fi->frames[f0].w == canvas_w() && _fi->frames[f0].h == canvas_h()))
@@ -845,37 +1044,89 @@ static char *readin(const char *name_, long &sz_) {
 }
 
 
-bool Fl_Anim_GIF::load(const char *name_) {
-  DEBUG(("Fl_Anim_GIF:::load '%s'\n", name_));
+bool GifInput::open(const char *name_) {
+  close();
+  if (!name_) { errno = ENOENT; return false; }
+#ifndef _WIN32
+  struct stat s = {};
+  int fd = fl_open(name_, O_RDONLY);
+  if (fd >= 0 && !fstat(fd, &s) && S_ISREG(s.st_mode) && s.st_size > 0) {
+    void *map = mmap(0, (size_t)s.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED) {
+      ::close(fd);
+      _data = (const uchar *)map;
+      _size = (long)s.st_size;
+      _mapped = true;
+      return true;
+    }
+  }
+  if (fd >= 0) ::close(fd);
+#endif
+  // no mapping possible: fall back to reading the file
+  long len = 0;
+  _data = (const uchar *)readin(name_, len);
+  _size = _data ? len : 0;
+  return _data != 0;
+}
+
+
+void GifInput::close() {
+#ifndef _WIN32
+  if (_mapped)
+    munmap((void *)_data, (size_t)_size);
+  else
+#endif
+  free((void *)_data);
+  _data = 0;
+  _size = 0;
+  _mapped = false;
+}
+
+
+void Fl_Anim_GIF::_clear(const char *name_) {
   clear_frames();
   copy_label(name_);
   free(_name);
   _name = name_ ? strdup(name_) : 0;
+}
 
-  // read gif file into memory
-  long len = 0;
-  char *buf = readin(name_, len);
-  if (!buf) {
+
+bool Fl_Anim_GIF::load(const char *name_) {
+  DEBUG(("Fl_Anim_GIF:::load '%s'\n", name_));
+
+  // map (or read) gif file into memory
+  GifInput gif;
+  if (!gif.open(name_)) {
+    _clear(name_);
     Fl::error("Fl_Anim_GIF: Unable to open '%s': %s\n", name_, strerror(errno));
-    free(buf);
     return false;
   }
+  return load(name_, gif.data(), (size_t)gif.size());
+} // load
+
+
+bool Fl_Anim_GIF::load(const char *imagename_,
+                       const unsigned char *data_, size_t length_) {
+  DEBUG(("Fl_Anim_GIF:::load '%s' (%lu bytes)\n",
+    imagename_, (unsigned long)length_));
+  _clear(imagename_);
+  const char *name_ = imagename_ ? imagename_ : "<data>"; // for messages
+  const uchar *buf = data_;
+  long len = buf ? (long)length_ : 0;
 
   // do own signature checking, to issue proper error/warning msg
-  // (gif_load accepts only 'GIF87a' or 'GIF89a')
+  // (gif_load is told to accept any version, see GIF_LAXV)
   if (len < 6 || buf[0] !='G' || buf[1] !='I' || buf[2] != 'F') {
     Fl::error("Fl_GIF_Image: %s is not a GIF file.\n", name_);
-    free(buf);
     return false;
   }
   if (buf[3]!='8' || buf[4] >'9' || buf[5] != 'a') {
     Fl::warning("%s is version %c%c%c.", name_, buf[3], buf [4], buf[5]);
-    memcpy(&buf[3], "89a", 3); // make gif_load happy
   }
 
   // decode GIF using gif_load.h
+  // (the data is used in place, it is neither copied nor modified)
   _fi->load(buf, len);
-  free(buf);
   _frame = _fi->frames_size - 1;
   _valid = _fi->valid;
 
@@ -960,6 +1211,8 @@ void Fl_Anim_GIF::set_frame(int frame_) {
     Inherited::image()->uncache();
 
   _fi->set_frame(_frame);
+  if (_fi->optimize_mem)
+    _fi->show(_frame);
 
   Inherited::image(image());
   if (parent() && ((last_frame >= 0 && (_fi->frames[last_frame].dispose == FrameInfo::DISPOSE_BACKGROUND ||
@@ -33,6 +33,7 @@
 extern "C" {
 #endif
 #include <stdint.h> /** imports uint8_t, uint16_t and uint32_t **/
+#include <string.h> /** imports memcpy() and memset()           **/
 #ifndef GIF_MGET
     #include <stdlib.h>
     #define GIF_MGET(m,s,a,c) m = (uint8_t*)realloc((c)? 0 : m, (c)? s : 0UL);
@@ -40,8 +41,18 @@ extern "C" {
 #ifndef GIF_BIGE
     #define GIF_BIGE 0
 #endif
-#ifndef GIF_EXTR
-    #define GIF_EXTR static
+#ifndef GIF_EXTR /** (unused entry points are no reason for a warning) **/
+    #if defined(__GNUC__)
+        #define GIF_EXTR static __attribute__((unused))
+    #else
+        #define GIF_EXTR static
+    #endif
+#endif
+#ifndef GIF_LAXV /** 1: accept any 'GIF' signature version; the caller **/
+    #define GIF_LAXV 0 /** is expected to check it on its own         **/
+#endif
+#ifndef GIF_FAST /** 1: use the fast LZW decoder (needs the size of the **/
+    #define GIF_FAST 1 /** largest frame data as additional memory)   **/
 #endif
 #define _GIF_SWAP(h) ((GIF_BIGE)? ((uint16_t)(h << 8) | (h >> 8)) : h)
 
@@ -59,8 +70,87 @@ struct GIF_WHDR {               /** ======== frame writer info: ======== **/
 };
 #pragma pack(pop)
 
+struct GIF_FIDX {               /** ======== frame index entry: ======== **/
+    long offs, cpal;            /** image data / palette offset, 0: none **/
+    long dlen;                  /** image data length (incl. sub-blocks) **/
+    int clrs, tran,             /** palette size, transparent index      **/
+        intr, mode,             /** interlace flag, frame blending mode  **/
+        frxd, fryd, frxo, fryo, /** frame dimensions and offset          **/
+        time;                   /** delay (same values as in GIF_WHDR)   **/
+};
+
 enum {GIF_NONE = 0, GIF_CURR = 1, GIF_BKGD = 2, GIF_PREV = 3};
 
+#pragma pack(push, 1) /** [ internal structures, do not use ] **/
+struct GIF_GHDR {        /** ========== GLOBAL GIF HEADER: ========== **/
+    uint8_t head[6];     /** 'GIF87a' / 'GIF89a' header signature     **/
+    uint16_t xdim, ydim; /** total image width, total image height    **/
+    uint8_t flgs;        /** FLAGS:
+                          GlobalPlt    bit 7     1: global palette exists
+                                                 0: local in each frame
+                          ClrRes       bit 6-4   bits/channel = ClrRes+1
+                          [reserved]   bit 3     0
+                          PixelBits    bit 2-0   |Plt| = 2 * 2^PixelBits
+                          **/
+    uint8_t bkgd, aspr;  /** background color index, aspect ratio     **/
+};
+struct GIF_FHDR {        /** ======= GIF FRAME MASTER HEADER: ======= **/
+    uint16_t frxo, fryo; /** offset of this frame in a "full" image   **/
+    uint16_t frxd, fryd; /** frame width, frame height                **/
+    uint8_t flgs;        /** FLAGS:
+                          LocalPlt     bit 7     1: local palette exists
+                                                 0: global is used
+                          Interlaced   bit 6     1: interlaced frame
+                                                 0: non-interlaced frame
+                          Sorted       bit 5     usually 0
+                          [reserved]   bit 4-3   [undefined]
+                          PixelBits    bit 2-0   |Plt| = 2 * 2^PixelBits
+                          **/
+};
+struct GIF_EGCH {        /** ==== [EXT] GRAPHICS CONTROL HEADER: ==== **/
+    uint8_t flgs;        /** FLAGS:
+                          [reserved]   bit 7-5   [undefined]
+                          BlendMode    bit 4-2   000: not set; static GIF
+                                                 001: leave result as is
+                                                 010: restore background
+                                                 011: restore previous
+                                                 1--: [undefined]
+                          UserInput    bit 1     1: show frame till input
+                                                 0: default; ~99% of GIFs
+                          TransColor   bit 0     1: got transparent color
+                                                 0: frame is fully opaque
+                          **/
+    uint16_t time;       /** delay in GIF time units; 1 unit = 10 ms  **/
+    uint8_t tran;        /** transparent color index                  **/
+};
+#pragma pack(pop)
+
+/** [ internal function, do not use ] **/
+static long _GIF_CheckHeader(struct GIF_GHDR *ghdr, long size) {
+    uint8_t *head;
+
+    /** checking if the stream is not empty and has a 'GIF8[79]a' signature,
+        and the data has sufficient size **/
+    return ghdr && (size > (long)sizeof(*ghdr)) && (*(head = ghdr->head) == 71)
+       && (head[1] == 73) && (head[2] == 70) && (GIF_LAXV || ((head[3] == 56)
+       && ((head[4] == 55) || (head[4] == 57)) && (head[5] == 97)));
+}
+
+/** [ internal function, do not use ] **/
+static void _GIF_FrameInfo(struct GIF_WHDR *whdr, struct GIF_FHDR *fhdr,
+                           struct GIF_EGCH *egch) {
+    whdr->intr = !!(fhdr->flgs & 0x40);
+    whdr->frxd = _GIF_SWAP(fhdr->frxd);
+    whdr->fryd = _GIF_SWAP(fhdr->fryd);
+    whdr->frxo = _GIF_SWAP(fhdr->frxo);
+    whdr->fryo = _GIF_SWAP(fhdr->fryo);
+    whdr->time = (egch)? _GIF_SWAP(egch->time) : 0;
+    whdr->tran = (egch && (egch->flgs & 0x01))? egch->tran : -1;
+    whdr->time = (egch && (egch->flgs & 0x02))? -whdr->time - 1 : whdr->time;
+    whdr->mode = (egch && !(egch->flgs & 0x10))?
+                 (egch->flgs & 0x0C) >> 2 : GIF_NONE;
+}
+
 /** [ internal function, do not use ] **/
 static long _GIF_SkipChunk(uint8_t **buff, long size) {
     long skip;
@@ -146,6 +236,125 @@ static long _GIF_LoadFrame(uint8_t **buff, long *size,
     return (++(*size) >= 0)? 0 : -4; /** ^- N.B.: 0 error is recoverable **/
 }
 
+/** [ internal function, do not use ] **/
+static uint64_t _GIF_Read64(uint8_t *bptr) {
+    uint64_t retn = 0;
+    long iter;
+
+    if (!GIF_BIGE)
+        memcpy(&retn, bptr, sizeof(retn));
+    else
+        for (iter = sizeof(retn); iter; retn = (retn << 8) | bptr[--iter]);
+    return retn;
+}
+
+/** [ internal function, do not use ]
+    Decodes the same as _GIF_LoadFrame() (incl. the return value, the values
+    of BUFF and SIZE and every byte written to BPTR), but it concatenates the
+    sub-blocks to DPTR first, reads the codes from a 64-bit accumulator and
+    emits the strings by copying them from their previous occurence in the
+    output instead of walking the code table. A code table entry is just an
+    offset and a length: the string of the previous code plus the first
+    pixel of the current one always lie adjacent in the output.
+    DLEN is the size of DPTR; if the frame data does not fit (plus 16 bytes
+    of padding for the accumulator) _GIF_LoadFrame() is used instead. **/
+static long _GIF_LoadFrameFast(uint8_t **buff, long *size, uint8_t *bptr,
+                               uint8_t *blen, uint8_t *dptr, long dlen) {
+    const long GIF_CLEN = 1 << 12;    /** code table length: 4096 items **/
+    uint32_t *soff = (uint32_t*)bptr - 2 * GIF_CLEN, /** string offsets **/
+             *slen = (uint32_t*)bptr - GIF_CLEN;     /** string lengths **/
+    uint64_t accu;    /** bit accumulator                               **/
+    uint8_t *iter,    /** data iterator                                 **/
+            *dend;    /** data position after the end-of-stream mark    **/
+    long ctbl, mask,  /** last code table index / code bit mask         **/
+         prev, curr,  /** codes from the stream: previous / current     **/
+         ctsz, ccsz,  /** code table bit sizes: min LZW / current       **/
+         bseq, bszc,  /** block length / bits in the accumulator        **/
+         dsiz, rest,  /** size of concatenated data / remaining size    **/
+         bits, over,  /** unread data bits / frame capacity exceeded    **/
+         bpos, cpos,  /** current / previous string offset in frame     **/
+         clen, ccnt;  /** previous string length / current string size  **/
+
+    /** preparing initial values (same checks as in _GIF_LoadFrame) **/
+    if ((*size - 1 <= (long)sizeof(uint16_t)) || !(*buff)[1])
+        return -4; /** unexpected end of the stream: insufficient size **/
+    if (((ctsz = **buff) < 2) || (ctsz > 8))
+        return -3; /** min LZW size is out of its nominal [2; 8] bounds **/
+
+    /** concatenating the sub-blocks (-2 for LZW size & end-of-stream mark) **/
+    for (iter = *buff + 1, rest = *size - 2, dsiz = 0;
+        ((rest -= (bseq = *iter++) + 1) >= 0) && bseq; iter += bseq) {
+        if (dsiz + bseq + 16 > dlen)
+            return _GIF_LoadFrame(buff, size, bptr, blen); /** no room **/
+        memcpy(dptr + dsiz, iter, (size_t)bseq);
+        dsiz += bseq;
+    }
+    memset(dptr + dsiz, 0, 16);
+    dend = iter;
+
+    ctbl = (1L << ctsz) + 1;
+    mask = (1L << (ccsz = ctsz + 1)) - 1;
+    for (iter = dptr, bits = dsiz * 8, accu = 0, bszc = over = 0,
+         bpos = cpos = clen = prev = 0; bits >= ccsz; prev = curr) {
+        if (bszc < ccsz) { /** refilling the accumulator **/
+            accu |= _GIF_Read64(iter) << bszc;
+            iter += (63 - bszc) >> 3;
+            bszc |= 56;
+        }
+        curr = (long)accu & mask;
+        accu >>= ccsz;
+        bszc -= ccsz;
+        bits -= ccsz;
+        if ((curr & ~1L) == (1L << ctsz)) {
+            if (curr & 1) { /** end-of-data code (ED); finding its block **/
+                for (bszc = (dsiz * 8 - bits - 1) >> 3,
+                     iter = *buff + 1, rest = *size - 2;
+                     (rest -= (bseq = *iter++) + 1), bszc >= bseq;
+                     bszc -= bseq, iter += bseq);
+                if (iter[bseq]) /** -1: no end-of-stream mark after ED **/
+                    return -1;
+                *buff = iter + bseq + 1;
+                *size = rest;
+                return 1; /** decoded **/
+            } /** table drop code (TD). TD = 1 << ctsz, ED = TD + 1 **/
+            mask = (1L << (ccsz = ctsz + 1)) - 1;
+            ctbl = curr + 1;
+            clen = 0;
+            continue;
+        }
+        if ((ctbl < GIF_CLEN) && (ctbl == mask) && (ctbl < GIF_CLEN - 1)) {
+            mask = mask + mask + 1;
+            ccsz++; /** the code table is full; extending **/
+        }
+        if (over) /** skipping pixels above frame capacity **/
+            continue;
+        ccnt = (ctbl > curr)? curr : prev; /** KwKwK: repeating prev. **/
+        ccnt = (ccnt > (1L << ctsz))? (long)slen[ccnt] : 1;
+        if (bptr + bpos + ccnt - 1 > blen) {
+            over = 1;
+            continue;
+        }
+        if (ccnt > 1) /** copying a multi-pixel string **/
+            memcpy(bptr + bpos, bptr + soff[(ctbl > curr)? curr : prev],
+                   (size_t)ccnt);
+        else
+            bptr[bpos] = (uint8_t)((ctbl > curr)? curr : prev);
+        if (ctbl < GIF_CLEN) { /** appending the code table **/
+            if (ctbl == curr)
+                bptr[bpos + ccnt++] = bptr[bpos];
+            else if (ctbl < curr)
+                return -5; /** wrong code in the stream **/
+            soff[ctbl] = (uint32_t)cpos;
+            slen[ctbl++] = (uint32_t)clen + 1;
+        }
+        cpos = bpos;
+        clen = ccnt;
+        bpos += ccnt;
+    }
+    *buff = dend; /** 0: no ED before end-of-stream mark; -4: see above **/
+    return ((*size = rest + 1) >= 0)? 0 : -4;
+}
+
 /** _________________________________________________________________________
     The main loading function. Returns the total number of frames if the data
     includes proper GIF ending, and otherwise it returns the number of frames
@@ -164,64 +373,21 @@ GIF_EXTR long GIF_Load(void *data, long size,
                        void (*gwfr)(void*, struct GIF_WHDR*),
                        void (*eamf)(void*, struct GIF_WHDR*),
                        void *anim, long skip) {
-    const long    GIF_BLEN = (1 << 12) * sizeof(uint32_t);
+    const long    GIF_BLEN = (1 << 12) * sizeof(uint32_t) * ((GIF_FAST)? 2 : 1);
     const uint8_t GIF_EHDM = 0x21, /** extension header mark              **/
                   GIF_FHDM = 0x2C, /** frame header mark                  **/
                   GIF_EOFM = 0x3B, /** end-of-file mark                   **/
                   GIF_EGCM = 0xF9, /** extension: graphics control mark   **/
                   GIF_EAMM = 0xFF; /** extension: app metadata mark       **/
-    #pragma pack(push, 1)
-    struct GIF_GHDR {        /** ========== GLOBAL GIF HEADER: ========== **/
-        uint8_t head[6];     /** 'GIF87a' / 'GIF89a' header signature     **/
-        uint16_t xdim, ydim; /** total image width, total image height    **/
-        uint8_t flgs;        /** FLAGS:
-                              GlobalPlt    bit 7     1: global palette exists
-                                                     0: local in each frame
-                              ClrRes       bit 6-4   bits/channel = ClrRes+1
-                              [reserved]   bit 3     0
-                              PixelBits    bit 2-0   |Plt| = 2 * 2^PixelBits
-                              **/
-        uint8_t bkgd, aspr;  /** background color index, aspect ratio     **/
-    } *ghdr = (struct GIF_GHDR*)data;
-    struct GIF_FHDR {        /** ======= GIF FRAME MASTER HEADER: ======= **/
-        uint16_t frxo, fryo; /** offset of this frame in a "full" image   **/
-        uint16_t frxd, fryd; /** frame width, frame height                **/
-        uint8_t flgs;        /** FLAGS:
-                              LocalPlt     bit 7     1: local palette exists
-                                                     0: global is used
-                              Interlaced   bit 6     1: interlaced frame
-                                                     0: non-interlaced frame
-                              Sorted       bit 5     usually 0
-                              [reserved]   bit 4-3   [undefined]
-                              PixelBits    bit 2-0   |Plt| = 2 * 2^PixelBits
-                              **/
-    } *fhdr;
-    struct GIF_EGCH {        /** ==== [EXT] GRAPHICS CONTROL HEADER: ==== **/
-        uint8_t flgs;        /** FLAGS:
-                              [reserved]   bit 7-5   [undefined]
-                              BlendMode    bit 4-2   000: not set; static GIF
-                                                     001: leave result as is
-                                                     010: restore background
-                                                     011: restore previous
-                                                     1--: [undefined]
-                              UserInput    bit 1     1: show frame till input
-                                                     0: default; ~99% of GIFs
-                              TransColor   bit 0     1: got transparent color
-                                                     0: frame is fully opaque
-                              **/
-        uint16_t time;       /** delay in GIF time units; 1 unit = 10 ms  **/
-        uint8_t tran;        /** transparent color index                  **/
-    } *egch = 0;
-    #pragma pack(pop)
+    struct GIF_GHDR *ghdr = (struct GIF_GHDR*)data;
+    struct GIF_FHDR *fhdr;
+    struct GIF_EGCH *egch = 0;
     struct GIF_WHDR wtmp, whdr = {0};
-    long desc, blen;
+    long desc, blen, dlen = 0;
     uint8_t *buff;
 
-    /** checking if the stream is not empty and has a 'GIF8[79]a' signature,
-        the data has sufficient size and frameskip value is non-negative **/
-    if (!ghdr || (size <= (long)sizeof(*ghdr)) || (*(buff = ghdr->head) != 71)
-    || (buff[1] != 73) || (buff[2] != 70) || (buff[3] != 56) || (skip < 0)
-    || ((buff[4] != 55) && (buff[4] != 57)) || (buff[5] != 97) || !gwfr)
+    /** checking the signature and if the frameskip value is non-negative **/
+    if (!_GIF_CheckHeader(ghdr, size) || (skip < 0) || !gwfr)
         return 0;
 
     buff = (uint8_t*)(ghdr + 1) /** skipping the global header and palette **/
@@ -244,9 +410,15 @@ GIF_EXTR long GIF_Load(void *data, long size,
             whdr.frxo = (whdr.frxd > whdr.frxo)? whdr.frxd : whdr.frxo;
             whdr.fryo = (whdr.fryd > whdr.fryo)? whdr.fryd : whdr.fryo;
             whdr.ifrm++;
+            if (GIF_FAST) { /** measuring the frame data for the fast LZW **/
+                wtmp.bptr = whdr.bptr;
+                _GIF_SkipChunk(&wtmp.bptr, blen);
+                if (wtmp.bptr - whdr.bptr + 16 > dlen)
+                    dlen = (long)(wtmp.bptr - whdr.bptr) + 16;
+            }
         }
     blen = whdr.frxo * whdr.fryo * (long)sizeof(*whdr.bptr);
-    GIF_MGET(whdr.bptr, (unsigned long)(blen + GIF_BLEN + 2), anim, 1)
+    GIF_MGET(whdr.bptr, (unsigned long)(blen + GIF_BLEN + 2 + dlen), anim, 1)
     whdr.nfrm = (desc != GIF_EOFM)? -whdr.ifrm : whdr.ifrm;
     for (whdr.bptr += GIF_BLEN, whdr.ifrm = -1; blen /** load all frames **/
      && (skip < ((whdr.nfrm < 0)? -whdr.nfrm : whdr.nfrm)) && (size >= 0);
@@ -261,20 +433,13 @@ GIF_EXTR long GIF_Load(void *data, long size,
                 whdr.cpal = 0; /** signal: no palette **/
             }
             if ((skip <= ++whdr.ifrm) && ((whdr.clrs < 0)
-            ||  (_GIF_LoadFrame(&buff, &size,
-                                 whdr.bptr, whdr.bptr + blen) < 0)))
+            ||  (((GIF_FAST)? _GIF_LoadFrameFast(&buff, &size, whdr.bptr,
+                                 whdr.bptr + blen, whdr.bptr + blen + 2, dlen)
+                            : _GIF_LoadFrame(&buff, &size,
+                                 whdr.bptr, whdr.bptr + blen)) < 0)))
                 size = -(whdr.ifrm--) - 1; /** failed to load the frame **/
             else if (skip <= whdr.ifrm) {
-                whdr.frxd = _GIF_SWAP(fhdr->frxd);
-                whdr.fryd = _GIF_SWAP(fhdr->fryd);
-                whdr.frxo = _GIF_SWAP(fhdr->frxo);
-                whdr.fryo = _GIF_SWAP(fhdr->fryo);
-                whdr.time = (egch)? _GIF_SWAP(egch->time) : 0;
-                whdr.tran = (egch && (egch->flgs & 0x01))? egch->tran : -1;
-                whdr.time = (egch && (egch->flgs & 0x02))? -whdr.time - 1
-                                                         : whdr.time;
-                whdr.mode = (egch && !(egch->flgs & 0x10))?
-                            (egch->flgs & 0x0C) >> 2 : GIF_NONE;
+                _GIF_FrameInfo(&whdr, fhdr, egch);
                 egch = 0;
                 wtmp = whdr;
                 gwfr(anim, &wtmp); /** passing the frame to the caller **/
@@ -290,10 +455,214 @@ GIF_EXTR long GIF_Load(void *data, long size,
             }
         }
     whdr.bptr -= GIF_BLEN; /** for excess pixel codes ----v (here & above) **/
-    GIF_MGET(whdr.bptr, (unsigned long)(blen + GIF_BLEN + 2), anim, 0)
+    GIF_MGET(whdr.bptr, (unsigned long)(blen + GIF_BLEN + 2 + dlen), anim, 0)
     return (whdr.nfrm < 0)? (skip - whdr.ifrm - 1) : (whdr.ifrm + 1);
 }
 
+/** _________________________________________________________________________
+    Builds an index of all frames without decoding any image data, so that
+    single frames can be loaded later by GIF_LoadIndexed() in any order.
+    Returns the number of frames like GIF_Load() does: negative if the data
+    has no proper GIF ending, 0 if there are no frames or it is not a GIF.
+    Up to NFID entries are written to FIDX, so the index can be sized by
+    calling it with NFID = 0 first. The metadata of all app extensions is
+    passed to EAMF (if set) during the call.
+    _________________________________________________________________________
+    DATA: raw data chunk, may be partial
+    SIZE: size of the data chunk that`s currently present
+    EAMF: metadata reader function, set to 0 if not needed
+    ANIM: implementation-specific data (e.g. a structure or a pointer to it)
+    FIDX: frame index with at least NFID entries, may be 0 if NFID is 0
+    NFID: number of entries in FIDX
+ **/
+GIF_EXTR long GIF_Index(void *data, long size,
+                        void (*eamf)(void*, struct GIF_WHDR*),
+                        void *anim, struct GIF_FIDX *fidx, long nfid) {
+    const uint8_t GIF_EHDM = 0x21, /** extension header mark              **/
+                  GIF_FHDM = 0x2C, /** frame header mark                  **/
+                  GIF_EOFM = 0x3B, /** end-of-file mark                   **/
+                  GIF_EGCM = 0xF9, /** extension: graphics control mark   **/
+                  GIF_EAMM = 0xFF; /** extension: app metadata mark       **/
+    struct GIF_GHDR *ghdr = (struct GIF_GHDR*)data;
+    struct GIF_FHDR *fhdr;
+    struct GIF_EGCH *egch = 0;
+    struct GIF_WHDR wtmp, whdr = {0};
+    struct GIF_FIDX *fcur = 0; /** entry whose data length is pending **/
+    long desc = 0;
+    uint8_t *buff;
+
+    if (!_GIF_CheckHeader(ghdr, size))
+        return 0;
+    buff = (uint8_t*)(ghdr + 1) /** skipping the global header and palette **/
+         + _GIF_LoadHeader(ghdr->flgs, 0, 0, 0, 0, 0L) * 3L;
+    if ((size -= buff - (uint8_t*)ghdr) <= 0)
+        return 0;
+
+    whdr.xdim = _GIF_SWAP(ghdr->xdim);
+    whdr.ydim = _GIF_SWAP(ghdr->ydim);
+    for (whdr.bkgd = ghdr->bkgd, --size; /** the same walk as in GIF_Load() **/
+        (size >= 0) && ((desc = *buff++) != GIF_EOFM);
+         size = _GIF_SkipChunk(&buff, size) - 1) {
+        if (fcur) { /** the data of the previous frame ends before DESC **/
+            fcur->dlen = (long)(buff - 1 - (uint8_t*)data) - fcur->offs;
+            fcur = 0;
+        }
+        if (desc == GIF_FHDM) { /** found a frame **/
+            *(void**)&whdr.cpal = (void*)(ghdr + 1);
+            fhdr = (struct GIF_FHDR*)buff;
+            if (!(whdr.clrs = _GIF_LoadHeader(ghdr->flgs, &buff, (void**)&whdr.cpal,
+                                        fhdr->flgs, &size, sizeof(*fhdr)))) {
+                whdr.clrs = 2 << ((ghdr->flgs >> 4) & 7); /** cresolution **/
+                whdr.cpal = 0; /** signal: no palette **/
+            }
+            else if (whdr.clrs < 0)
+                break;
+            _GIF_FrameInfo(&whdr, fhdr, egch);
+            egch = 0;
+            if (whdr.ifrm < nfid) {
+                fidx[whdr.ifrm].offs = (long)(buff - (uint8_t*)data);
+                fidx[whdr.ifrm].cpal = (whdr.cpal)?
+                                       (long)((uint8_t*)whdr.cpal
+                                            - (uint8_t*)data) : 0;
+                fidx[whdr.ifrm].clrs = whdr.clrs;
+                fidx[whdr.ifrm].tran = whdr.tran;
+                fidx[whdr.ifrm].intr = whdr.intr;
+                fidx[whdr.ifrm].mode = whdr.mode;
+                fidx[whdr.ifrm].frxd = whdr.frxd;
+                fidx[whdr.ifrm].fryd = whdr.fryd;
+                fidx[whdr.ifrm].frxo = whdr.frxo;
+                fidx[whdr.ifrm].fryo = whdr.fryo;
+                fidx[whdr.ifrm].time = whdr.time;
+                fidx[whdr.ifrm].dlen = 0;
+                fcur = fidx + whdr.ifrm;
+            }
+            whdr.ifrm++;
+        }
+        else if (desc == GIF_EHDM) { /** found an extension **/
+            if (*buff == GIF_EGCM) /** graphics control ext. **/
+                egch = (struct GIF_EGCH*)(buff + 1 + 1);
+            else if ((*buff == GIF_EAMM) && eamf) { /** app metadata ext. **/
+                wtmp = whdr;
+                wtmp.bptr = buff + 1 + 1; /** just passing the raw chunk **/
+                eamf(anim, &wtmp);
+            }
+        }
+    }
+    if (fcur) /** the last frame: up to the end mark or the end of data **/
+        fcur->dlen = (long)(buff - (desc == GIF_EOFM) - (uint8_t*)data)
+                   - fcur->offs;
+    return (desc != GIF_EOFM)? -whdr.ifrm : whdr.ifrm;
+}
+
+/** _________________________________________________________________________
+    Loads NLOAD consecutive frames from an index made by GIF_Index(), starting
+    at IFRM, and passes each of them to GWFR the same way GIF_Load() does.
+    All frames are decoded into one buffer, sized for the largest of them,
+    so the buffer passed to GWFR is only valid until it returns.
+    Returns the number of frames loaded; loading stops at the first frame that
+    is damaged or out of range. Pixels not covered by the image data of a short
+    frame are set to 0.
+    _________________________________________________________________________
+    DATA: raw data chunk, the same as passed to GIF_Index()
+    SIZE: size of the data chunk, the same as passed to GIF_Index()
+    GWFR: frame writer function, MANDATORY
+    ANIM: implementation-specific data (e.g. a structure or a pointer to it)
+    FIDX: frame index, filled by GIF_Index()
+    NFRM: frame count returned by GIF_Index()
+    IFRM: number of the first frame to load, [0; |NFRM| - 1]
+    NLOAD: number of frames to load
+ **/
+GIF_EXTR long GIF_LoadIndexedRange(void *data, long size,
+                                   void (*gwfr)(void*, struct GIF_WHDR*),
+                                   void *anim, struct GIF_FIDX *fidx,
+                                   long nfrm, long ifrm, long nload) {
+    const long GIF_BLEN = (1 << 12) * sizeof(uint32_t) * ((GIF_FAST)? 2 : 1),
+               GIF_SLEN = 1 << 12; /** max. string length: 4096 pixels  **/
+    struct GIF_GHDR *ghdr = (struct GIF_GHDR*)data;
+    struct GIF_WHDR wtmp, whdr = {0};
+    struct GIF_FIDX *fcur;
+    long blen = 0, dlen = 0, flen, fsiz, iter, load = 0;
+    uint8_t *buff;
+
+    if (!_GIF_CheckHeader(ghdr, size) || !gwfr || !fidx || (ifrm < 0))
+        return 0;
+    if (nload > ((nfrm < 0)? -nfrm : nfrm) - ifrm)
+        nload = ((nfrm < 0)? -nfrm : nfrm) - ifrm;
+    for (iter = 0; iter < nload; iter++) { /** sizing for the largest frame **/
+        fcur = fidx + ifrm + iter;
+        if ((fcur->offs <= 0) || (fcur->offs >= size)) {
+            nload = iter; /** (the frames before it can be loaded) **/
+            break;
+        }
+        if ((flen = fcur->frxd * (long)fcur->fryd + GIF_SLEN) > blen)
+            blen = flen;
+        if (GIF_FAST && (fcur->dlen + 16 > dlen)) /** for the fast LZW **/
+            dlen = fcur->dlen + 16;
+    } /** (dlen: room for a string that starts inside the frame data) **/
+    if (nload <= 0)
+        return 0;
+    GIF_MGET(whdr.bptr, (unsigned long)(blen + GIF_BLEN + 2 + dlen), anim, 1)
+    if (!whdr.bptr)
+        return 0;
+    whdr.bptr += GIF_BLEN;
+    whdr.xdim = _GIF_SWAP(ghdr->xdim);
+    whdr.ydim = _GIF_SWAP(ghdr->ydim);
+    whdr.bkgd = ghdr->bkgd;
+    whdr.nfrm = nfrm;
+    for (; load < nload; load++) {
+        fcur = fidx + ifrm + load;
+        buff = (uint8_t*)data + fcur->offs;
+        fsiz = size - fcur->offs;
+        flen = fcur->frxd * (long)fcur->fryd + GIF_SLEN;
+        memset(whdr.bptr, 0, (size_t)flen);
+        if (((GIF_FAST)? _GIF_LoadFrameFast(&buff, &fsiz, whdr.bptr,
+                             whdr.bptr + flen, whdr.bptr + blen + 2, dlen)
+                       : _GIF_LoadFrame(&buff, &fsiz, whdr.bptr,
+                             whdr.bptr + flen)) < 0)
+            break;
+        whdr.clrs = fcur->clrs;
+        whdr.tran = fcur->tran;
+        whdr.intr = fcur->intr;
+        whdr.mode = fcur->mode;
+        whdr.frxd = fcur->frxd;
+        whdr.fryd = fcur->fryd;
+        whdr.frxo = fcur->frxo;
+        whdr.fryo = fcur->fryo;
+        whdr.time = fcur->time;
+        whdr.ifrm = ifrm + load;
+        *(void**)&whdr.cpal = (fcur->cpal)? (uint8_t*)data + fcur->cpal : 0;
+        wtmp = whdr;
+        gwfr(anim, &wtmp); /** passing the frame to the caller **/
+    }
+    whdr.bptr -= GIF_BLEN;
+    GIF_MGET(whdr.bptr, (unsigned long)(blen + GIF_BLEN + 2 + dlen), anim, 0)
+    return load;
+}
+
+/** _________________________________________________________________________
+    Loads a single frame from an index made by GIF_Index() and passes it to
+    GWFR the same way GIF_Load() does. Frames don't depend on each other, so
+    they can be loaded in any order (and concurrently, if GIF_MGET allows).
+    Every call allocates a buffer for the frame; to load consecutive frames
+    GIF_LoadIndexedRange() reuses one buffer for all of them.
+    Returns 1 if the frame was loaded, 0 if it is damaged or out of range.
+    Pixels not covered by the image data of a short frame are set to 0.
+    _________________________________________________________________________
+    DATA: raw data chunk, the same as passed to GIF_Index()
+    SIZE: size of the data chunk, the same as passed to GIF_Index()
+    GWFR: frame writer function, MANDATORY
+    ANIM: implementation-specific data (e.g. a structure or a pointer to it)
+    FIDX: frame index, filled by GIF_Index()
+    NFRM: frame count returned by GIF_Index()
+    IFRM: number of the frame to load, [0; |NFRM| - 1]
+ **/
+GIF_EXTR long GIF_LoadIndexed(void *data, long size,
+                              void (*gwfr)(void*, struct GIF_WHDR*),
+                              void *anim, struct GIF_FIDX *fidx,
+                              long nfrm, long ifrm) {
+    return GIF_LoadIndexedRange(data, size, gwfr, anim, fidx, nfrm, ifrm, 1);
+}
+
 #undef _GIF_SWAP
 #ifdef __cplusplus
 }
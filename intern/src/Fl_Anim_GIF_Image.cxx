@@ -23,123 +23,34 @@
 #include <errno.h>
 #include <math.h> // lround()
 
-#include "gif_load.h"
+// Use SIMD instructions for compositing the frame images,
+// if the compiler targets SSE2 (default on x86_64) or AVX2.
+#ifndef USE_SSE2
+#  if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#    define USE_SSE2 1
+#  else
+#    define USE_SSE2 0
+#  endif
+#endif
+#ifndef USE_AVX2
+#  if defined(__AVX2__)
+#    define USE_AVX2 1
+#  else
+#    define USE_AVX2 0
+#  endif
+#endif
+#if USE_AVX2
+#  include <immintrin.h>
+#elif USE_SSE2
+#  include <emmintrin.h>
+#endif
 
-#include <FL/Fl_Anim_GIF_Image.H>
+#include "Fl_Anim_GIF_Image_Private.H"
 
 /*static*/
 bool Fl_GIF_Image::animate = false;
 
 
-///////////////////////////////////////////////////////////////////////
-//  Internal helper classes/structs
-///////////////////////////////////////////////////////////////////////
-
-class Fl_Anim_GIF_Image::FrameInfo {
-  friend class Fl_Anim_GIF_Image;
-
-  enum Transparency {
-    T_NONE = 0xff,
-    T_FULL = 0
-  };
-
-  struct RGBA_Color {
-    uchar r, g, b, alpha;
-    RGBA_Color(uchar r_ = 0, uchar g_ = 0, uchar b_ = 0, uchar a_ = T_NONE) :
-      r(r_), g(g_), b(b_), alpha(a_) {}
-  };
-
-  enum Dispose {
-    DISPOSE_UNDEF = GIF_NONE,
-    DISPOSE_NOT = GIF_CURR,
-    DISPOSE_BACKGROUND = GIF_BKGD,
-    DISPOSE_PREVIOUS = GIF_PREV
-  };
-
-  struct GifFrame {
-    GifFrame() :
-      rgb(0),
-      scalable(0),
-      average_color(FL_BLACK),
-      average_weight(-1),
-      desaturated(false),
-      x(0),
-      y(0),
-      w(0),
-      h(0),
-      delay(0),
-      dispose(DISPOSE_UNDEF),
-      transparent_color_index(-1) {}
-    Fl_RGB_Image *rgb;                // full frame image
-    Fl_Shared_Image *scalable;        // used for hardware-accelerated scaling
-    Fl_Color average_color;           // last average color
-    float average_weight;             // last average weight
-    bool desaturated;                 // flag if frame is desaturated
-    unsigned short x, y, w, h;        // frame original dimensions
-    double delay;                     // delay (already converted to ms)
-    Dispose dispose;                  // disposal method
-    int transparent_color_index;      // needed for dispose()
-    RGBA_Color transparent_color;     // needed for dispose()
-  };
-
-  FrameInfo(Fl_Anim_GIF_Image *anim_) :
-    _anim(anim_),
-    valid(false),
-    frames_size(0),
-    frames(0),
-    loop_count(1),
-    loop(0),
-    background_color_index(-1),
-    canvas_w(0),
-    canvas_h(0),
-    desaturate(false),
-    average_color(FL_BLACK),
-    average_weight(-1),
-    scaling((Fl_RGB_Scaling)0),
-    _debug(0),
-    optimize_mem(false),
-    offscreen(0) {}
-  ~FrameInfo();
-  void clear();
-  void copy(const FrameInfo& fi_);
-  double convertDelay(int d_) const;
-  int debug() const { return _debug; }
-  int frame_count(char *buf_, long len_);
-  bool load(char *buf_, long len_);
-  bool push_back_frame(const GifFrame &frame_);
-  void resize(int W_, int H_);
-  void scale_frame(int frame_);
-  void set_frame(int frame_);
-private:
-  Fl_Anim_GIF_Image *_anim;         // a pointer to the Image (only needed for name())
-  bool valid;                       // flag ig valid data
-  int frames_size;                  // number of frames stored in 'frames'
-  GifFrame *frames;                 // "vector" for frames
-  int loop_count;                   // loop count from file
-  int loop;                         // current loop count
-  int background_color_index;       // needed for dispose()
-  RGBA_Color background_color;      // needed for dispose()
-  GifFrame frame;                   // current processed frame
-  int canvas_w;                     // width of GIF from header
-  int canvas_h;                     // height of GIF from header
-  bool desaturate;                  // flag if frames should be desaturated
-  Fl_Color average_color;           // color for color_average()
-  float average_weight;             // weight for color_average (negative: none)
-  Fl_RGB_Scaling scaling;           // saved scaling method for scale_frame()
-  int _debug;                       // Flag for debug outputs
-  bool optimize_mem;                // Flag to store frames in original dimensions
-  uchar *offscreen;                 // internal "offscreen" buffer
-private:
-  static void cb_gl_frame(void *ctx_, GIF_WHDR *whdr_);
-  static void cb_gl_extension(void *ctx_, GIF_WHDR *whdr_);
-private:
-  void dispose(int frame_);
-  void onFrameLoaded(GIF_WHDR &whdr_);
-  void onExtensionLoaded(GIF_WHDR &whdr_);
-  void setToBackGround(int frame_);
-};
-
-
 #define LOG(x) if (debug()) printf x
 #define DEBUG(x) if (debug() >= 2) printf x
 #ifndef LOG
@@ -159,18 +70,97 @@ Fl_Anim_GIF_Image::FrameInfo::~FrameInfo() {
 }
 
 
+void Fl_Anim_GIF_Image::FrameInfo::Canvas::clear() {
+  delete[] offscreen;
+  offscreen = 0;
+  delete[] saved;
+  saved = 0;
+  saved_x = saved_y = saved_w = saved_h = 0;
+  saved_alloc = 0;
+  next = 0;
+  dispose = DISPOSE_UNDEF;
+  transparent_color_index = -1;
+  frame_x = frame_y = frame_w = frame_h = 0;
+  changed_x = changed_y = changed_w = changed_h = 0;
+}
+
+
 void Fl_Anim_GIF_Image::FrameInfo::clear() {
+  // stop loading in the background
+  if (async) {
+    async->detach();
+    async = 0;
+  }
+  if (compress_armed)
+    Fl::remove_timeout(Fl_Anim_GIF_Image::cb_compress, _anim);
+  compress_armed = false;
+  waiting = false;
+  resize_w = resize_h = 0;
   // release all allocated memory
-  while (frames_size-- > 0) {
-    if (frames[frames_size].scalable)
-      frames[frames_size].scalable->release();
-    delete frames[frames_size].rgb;
+  while (frames_size-- > 0)
+    release_frame(frames_size);
+  memset(&memory, 0, sizeof(memory));
+  free(expanded);
+  expanded = 0;
+  expanded_size = 0;
+  expanded_alloc = 0;
+  delete[] previous;
+  previous = 0;
+  keyframe = 0;
+  delete[] recon;
+  recon = 0;
+  recon_frame = -1;
+  loader.clear();
+  replay.clear();
+  shown.clear();
+  delete shown_rgb;
+  shown_rgb = 0;
+  if (pixmap) {
+    for (int i = 0; i < pixmap_count; i++)
+      delete[] pixmap[i];
+    delete[] pixmap;
   }
-  delete[] offscreen;
-  offscreen = 0;
+  pixmap = 0;
+  pixmap_count = 0;
+  free(layers);
+  layers = 0;
+  layers_size = 0;
+  layers_alloc = 0;
+  release_source();
+  free(averages);
+  averages = 0;
+  averages_size = 0;
+  pristine = false;
+  delete content;
+  content = 0;
+  content_hash = 0;
+  content_hashed = false;
+  content_size = 0;
+  duplicates = 0;
+  saved_bytes = 0;
+  free(by_hash);
+  by_hash = 0;
+  by_hash_size = 0;
+  by_hash_count = 0;
   free(frames);
   frames = 0;
   frames_size = 0;
+  frames_alloc = 0;
+}
+
+
+void Fl_Anim_GIF_Image::FrameInfo::color_average(int frame_, Fl_Color c_, float i_) {
+  // apply color_average() to frame 'frame_' permanently
+  // (also to the stored pixels resp. the color table, they are
+  // used for expanding)
+  decompress(frame_);
+  unshare(frame_);
+  GifFrame &f = frames[frame_];
+  if (f.pixels)
+    f.store->color_average(f, c_, i_);
+  recon_frame = -1;
+  if (f.rgb)
+    f.rgb->color_average(c_, i_);
 }
 
 
@@ -183,7 +173,7 @@ double Fl_Anim_GIF_Image::FrameInfo::convertDelay(int d_) const {
 
 /*static*/
 void Fl_Anim_GIF_Image::FrameInfo::cb_gl_frame(void *ctx_, GIF_WHDR *whdr_) {
-  // called from GIF_Load() when image block loaded
+  // called from GIF_LoadIndexed() when image block loaded
   FrameInfo *fi = (FrameInfo *)ctx_;
   fi->onFrameLoaded(*whdr_);
 }
@@ -191,16 +181,68 @@ void Fl_Anim_GIF_Image::FrameInfo::cb_gl_frame(void *ctx_, GIF_WHDR *whdr_) {
 
 /*static*/
 void Fl_Anim_GIF_Image::FrameInfo::cb_gl_extension(void *ctx_, GIF_WHDR *whdr_) {
-  // called from GIF_Load() when extension block loaded
+  // called from GIF_Index() when extension block loaded
   FrameInfo *fi = (FrameInfo *)ctx_;
   fi->onExtensionLoaded(*whdr_);
 }
 
 
-void Fl_Anim_GIF_Image::FrameInfo::copy(const FrameInfo& fi_) {
-  // copy from source
+static void add_rect(int &x_, int &y_, int &w_, int &h_,
+                     int x2_, int y2_, int w2_, int h2_) {
+  // Extend the rectangle 'x_/y_/w_/h_' to the bounding box of
+  // itself and 'x2_/y2_/w2_/h2_' (empty rectangles are ignored).
+  if (w2_ <= 0 || h2_ <= 0)
+    return;
+  if (w_ <= 0 || h_ <= 0) {
+    x_ = x2_;
+    y_ = y2_;
+    w_ = w2_;
+    h_ = h2_;
+    return;
+  }
+  int right = x_ + w_ > x2_ + w2_ ? x_ + w_ : x2_ + w2_;
+  int bottom = y_ + h_ > y2_ + h2_ ? y_ + h_ : y2_ + h2_;
+  x_ = x_ < x2_ ? x_ : x2_;
+  y_ = y_ < y2_ ? y_ : y2_;
+  w_ = right - x_;
+  h_ = bottom - y_;
+}
+
+
+static void scale_rect(unsigned short &x_, unsigned short &y_,
+                       unsigned short &w_, unsigned short &h_,
+                       double sx_, double sy_, int max_w_, int max_h_) {
+  // Scale the rectangle 'x_/y_/w_/h_' by 'sx_', 'sy_', so that it
+  // still covers all scaled pixels: rounded outwards and, as scaling
+  // blends neighboured pixels, one pixel larger on each side
+  // (clipped to 'max_w_' x 'max_h_').
+  if (!w_ || !h_)
+    return;
+  int left = (int)floor(x_ * sx_) - 1;
+  int top = (int)floor(y_ * sy_) - 1;
+  int right = (int)ceil((x_ + w_) * sx_) + 1;
+  int bottom = (int)ceil((y_ + h_) * sy_) + 1;
+  if (left < 0) left = 0;
+  if (top < 0) top = 0;
+  if (right > max_w_) right = max_w_;
+  if (bottom > max_h_) bottom = max_h_;
+  x_ = left;
+  y_ = top;
+  w_ = right > left ? right - left : 0;
+  h_ = bottom > top ? bottom - top : 0;
+}
+
+
+void Fl_Anim_GIF_Image::FrameInfo::copy(FrameInfo& fi_) {
+  // copy from source: the frame data is shared until it is changed
+  // (e.g. by scaling, that will be done adhoc when frame is displayed),
+  // evicted frames are decoded again by the copy when needed, from the
+  // GIF data and the frame index shared with the source
+  reserve_frames(fi_.frames_size);
   for (int i = 0; i < fi_.frames_size; i++) {
-    if (!push_back_frame(fi_.frames[i])) {
+    GifFrame &f = fi_.frames[i];
+    if (!(f.evicted ? push_back_frame(f) :
+          f.compressed ? push_back_compressed(f) : push_back_shared(f))) {
       break;
     }
     double scale_factor_x = (double)canvas_w / (double)fi_.canvas_w;
@@ -213,73 +255,478 @@ void Fl_Anim_GIF_Image::FrameInfo::copy(const FrameInfo& fi_) {
       frames[i].w = new_w;
       frames[i].h = new_h;
     }
-    // just copy data 1:1 now - scaling will be done adhoc when frame is displayed
-    frames[i].rgb = (Fl_RGB_Image *)fi_.frames[i].rgb->copy();
-    frames[i].scalable = 0;
+    if (canvas_w != fi_.canvas_w || canvas_h != fi_.canvas_h)
+      scale_rect(frames[i].dirty_x, frames[i].dirty_y, frames[i].dirty_w, frames[i].dirty_h,
+                 scale_factor_x, scale_factor_y, canvas_w, canvas_h);
   }
   optimize_mem = fi_.optimize_mem;
+  if (optimize_mem)
+    build_layers();
+  indexed = fi_.indexed;
+  deltas = fi_.deltas;
+  pack = fi_.pack;
+  compress = fi_.compress;
+  merge = fi_.merge;
+  share = fi_.share;
+  limit = fi_.limit;
+  _debug = fi_._debug;
+  if (fi_.index) {
+    if (!fi_.source_refs)
+      fi_.source_refs = new int(1);
+    (*fi_.source_refs)++;
+    source_refs = fi_.source_refs;
+    source = fi_.source;
+    index = fi_.index;
+    index_size = fi_.index_size;
+    index_nfrm = fi_.index_nfrm;
+  }
+  if (fi_.averages_size) {
+    // (applied to the frames decoded again like in the source)
+    averages = (Average *)malloc(fi_.averages_size * sizeof(Average));
+    if (averages) {
+      memcpy(averages, fi_.averages, fi_.averages_size * sizeof(Average));
+      averages_size = fi_.averages_size;
+    }
+  }
+  background_color_index = fi_.background_color_index; // (for redecode())
+  background_color = fi_.background_color;
   scaling = Fl_Image::RGB_scaling(); // save current scaling mode
   loop_count = fi_.loop_count; // .. and the loop_count!
+  enforce_budget(-1);
+  arm_compress();
+}
+
+
+static void composite_row(uint32_t *dst_, const uchar *src_, int n_,
+                          const uint32_t *lut_, int tran_) {
+  // Write the colors of 'n_' pixel indices from 'src_' to 'dst_'
+  // using the palette 'lut_'. Pixels with the index 'tran_' are left
+  // untouched (no transparency if 'tran_' is negative).
+  int x = 0;
+#if USE_AVX2
+  const __m256i vtran = _mm256_set1_epi32(tran_);
+  const __m256i ones = _mm256_set1_epi32(-1);
+  for (; x + 8 <= n_; x += 8) {
+    __m256i idx = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(src_ + x)));
+    __m256i mask = _mm256_xor_si256(_mm256_cmpeq_epi32(idx, vtran), ones);
+    __m256i rgba = _mm256_i32gather_epi32((const int *)lut_, idx, 4);
+    _mm256_maskstore_epi32((int *)(dst_ + x), mask, rgba);
+  }
+#elif USE_SSE2
+  // check 16 pixels at once: fully transparent runs are skipped,
+  // the others are stored 4 pixels at a time, with the transparent
+  // pixels of 'dst_' blended back in by their mask
+  const __m128i vtran = _mm_set1_epi8((char)tran_);
+  for (; x + 16 <= n_; x += 16) {
+    const uchar *src = src_ + x;
+    uint32_t *dst = dst_ + x;
+    __m128i eq = _mm_setzero_si128();
+    int mask = 0;
+    if (tran_ >= 0) {
+      eq = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)src), vtran);
+      mask = _mm_movemask_epi8(eq);
+    }
+    if (mask == 0xffff)
+      continue;
+    __m128i eq16[2] = { _mm_unpacklo_epi8(eq, eq), _mm_unpackhi_epi8(eq, eq) };
+    for (int i = 0; i < 16; i += 4) {
+      __m128i rgba = _mm_set_epi32((int)lut_[src[i + 3]], (int)lut_[src[i + 2]],
+                                   (int)lut_[src[i + 1]], (int)lut_[src[i]]);
+      if (mask & (0xf << i)) {
+        __m128i m = i & 4 ? _mm_unpackhi_epi16(eq16[i >> 3], eq16[i >> 3])
+                          : _mm_unpacklo_epi16(eq16[i >> 3], eq16[i >> 3]);
+        __m128i old = _mm_loadu_si128((const __m128i *)(dst + i));
+        rgba = _mm_or_si128(_mm_and_si128(m, old), _mm_andnot_si128(m, rgba));
+      }
+      _mm_storeu_si128((__m128i *)(dst + i), rgba);
+    }
+  }
+#endif
+  for (; x < n_; x++) {
+    uchar c = src_[x];
+    if (c != tran_)
+      dst_[x] = lut_[c];
+  }
+}
+
+
+static void fill_row(uint32_t *dst_, int n_, uint32_t color_) {
+  // Set 'n_' pixels of 'dst_' to 'color_'.
+  int x = 0;
+#if USE_AVX2
+  const __m256i v = _mm256_set1_epi32((int)color_);
+  for (; x + 8 <= n_; x += 8)
+    _mm256_storeu_si256((__m256i *)(dst_ + x), v);
+#elif USE_SSE2
+  const __m128i v = _mm_set1_epi32((int)color_);
+  for (; x + 4 <= n_; x += 4)
+    _mm_storeu_si128((__m128i *)(dst_ + x), v);
+#endif
+  for (; x < n_; x++)
+    dst_[x] = color_;
+}
+
+
+static void draw_over(uchar *dst_, int dst_w_, int dst_h_,
+                      const Fl_RGB_Image *rgb_, int x_, int y_) {
+  // Draw the image 'rgb_' at 'x_/y_' over the RGBA image 'dst_'
+  // of size 'dst_w_' x 'dst_h_' (clipped, alpha blended).
+  int d = rgb_->d();
+  int ld = rgb_->ld() ? rgb_->ld() : rgb_->w() * d;
+  int w = x_ + rgb_->w() <= dst_w_ ? rgb_->w() : dst_w_ - x_;
+  int h = y_ + rgb_->h() <= dst_h_ ? rgb_->h() : dst_h_ - y_;
+  const uchar *src = (const uchar *)rgb_->data()[0];
+  for (int y = 0; y < h; y++) {
+    const uchar *s = src + (size_t)y * ld;
+    uchar *p = dst_ + ((size_t)(y_ + y) * dst_w_ + x_) * 4;
+    for (int x = 0; x < w; x++, s += d, p += 4) {
+      int a = d == 2 || d == 4 ? s[d - 1] : 0xff;
+      if (!a)
+        continue;
+      uchar c[3] = { s[0], d < 3 ? s[0] : s[1], d < 3 ? s[0] : s[2] }; // (gray if desaturated)
+      if (a == 0xff) {
+        memcpy(p, c, 3);
+        p[3] = 0xff;
+        continue;
+      }
+      // (partly transparent pixels come from scaling)
+      int pa = p[3] * (0xff - a) / 0xff;
+      int oa = a + pa;
+      for (int i = 0; i < 3; i++)
+        p[i] = (uchar)((c[i] * a + p[i] * pa) / oa);
+      p[3] = (uchar)oa;
+    }
+  }
 }
 
 
-static void deinterlace(GIF_WHDR &whdr_) {
-  if (!whdr_.intr) return;
-  // this code is from 'gif_load's example program (with adaptions)
-  int iter = 0;
-  int ddst = 0;
-  int ifin = 4;
-  size_t sz = whdr_.frxd * whdr_.fryd;
-  uchar *buf = new uchar[sz];
-  memset(buf, whdr_.tran, sz);
-  for (int dsrc = -1; iter < ifin; iter++)
-    for (int yoff = 16 >> ((iter > 1) ? iter : 1), y = (8 >> iter) & 7;
-      y < whdr_.fryd; y += yoff)
-        for (int x = 0; x < whdr_.frxd; x++)
-          if (whdr_.tran != (int)whdr_.bptr[++dsrc])
-            buf[whdr_.frxd * y + x + ddst] = whdr_.bptr[dsrc];
-  memcpy(whdr_.bptr, buf, sz);
-  delete[] buf;
+static bool is_opaque(const uchar *buf_, size_t n_) {
+  // check if none of the 'n_' RGBA pixels of 'buf_' is (partly) transparent
+  for (size_t i = 0; i < n_; i++)
+    if (buf_[i * 4 + 3] != 0xff)
+      return false;
+  return true;
+}
+
+
+static uchar *crop_transparent(uchar *buf_, int &x_, int &y_, int &w_, int &h_) {
+  // Crop the RGBA image 'buf_' of size 'w_' x 'h_' to the bounding box
+  // of its pixels that are not fully transparent (at least one pixel),
+  // 'x_'/'y_' are moved by the offset of the box. Returns the cropped
+  // image ('buf_' is deleted) or 'buf_' if there is nothing to crop.
+  if (w_ <= 0 || h_ <= 0)
+    return buf_;
+  int left = w_, right = 0, top = h_, bottom = 0;
+  for (int y = 0; y < h_; y++) {
+    const uchar *row = buf_ + (size_t)y * w_ * 4;
+    int l = 0;
+    while (l < w_ && !row[l * 4 + 3])
+      l++;
+    if (l == w_)
+      continue;
+    int r = w_;
+    while (!row[(r - 1) * 4 + 3])
+      r--;
+    if (l < left) left = l;
+    if (r > right) right = r;
+    if (y < top) top = y;
+    bottom = y + 1;
+  }
+  if (top >= bottom) {
+    left = top = 0; // all transparent
+    right = bottom = 1;
+  }
+  if (left == 0 && top == 0 && right == w_ && bottom == h_)
+    return buf_;
+  int w = right - left, h = bottom - top;
+  uchar *buf = new uchar[(size_t)w * h * 4];
+  for (int y = 0; y < h; y++)
+    memcpy(buf + (size_t)y * w * 4, buf_ + ((size_t)(top + y) * w_ + left) * 4, w * 4);
+  delete[] buf_;
+  x_ += left;
+  y_ += top;
+  w_ = w;
+  h_ = h;
+  return buf;
 }
 
 
-void Fl_Anim_GIF_Image::FrameInfo::dispose(int frame_) {
-  if (frame_ < 0) {
+static void changed_rect(const uint32_t *a_, const uint32_t *b_, int stride_,
+                         int w_, int h_, int &x_, int &y_, int &rw_, int &rh_) {
+  // Find the bounding box of the pixels that differ between the
+  // images 'a_' and 'b_' of size 'w_' x 'h_' (0 x 0 if they are equal).
+  // Their rows are 'stride_' pixels apart.
+  int top = 0, bottom = h_;
+  while (top < bottom && !memcmp(a_ + (size_t)top * stride_, b_ + (size_t)top * stride_, w_ * 4))
+    top++;
+  while (bottom > top && !memcmp(a_ + (size_t)(bottom - 1) * stride_,
+                                 b_ + (size_t)(bottom - 1) * stride_, w_ * 4))
+    bottom--;
+  int left = w_, right = 0;
+  for (int y = top; y < bottom; y++) {
+    const uint32_t *a = a_ + (size_t)y * stride_;
+    const uint32_t *b = b_ + (size_t)y * stride_;
+    int l = 0;
+    while (l < left && a[l] == b[l])
+      l++;
+    left = l;
+    int r = w_;
+    while (r > right && a[r - 1] == b[r - 1])
+      r--;
+    right = r;
+  }
+  if (top == bottom) {
+    x_ = y_ = rw_ = rh_ = 0;
     return;
   }
-  // dispose frame with index 'frame_' to offscreen buffer
-  switch (frames[frame_].dispose) {
-    case DISPOSE_PREVIOUS: {
-        // dispose to previous restores to first not DISPOSE_TO_PREVIOUS frame
-        int prev(frame_);
-        while (prev > 0 && frames[prev].dispose == DISPOSE_PREVIOUS)
-          prev--;
-        if (prev == 0 && frames[prev].dispose == DISPOSE_PREVIOUS) {
-          setToBackGround(frame_);
-          return;
-        }
-        DEBUG(("  dispose frame %d to previous frame %d\n", frame_ + 1, prev + 1));
-        // copy the previous image data..
-        uchar *dst = offscreen;
-        int px = frames[prev].x;
-        int py = frames[prev].y;
-        int pw = frames[prev].w;
-        int ph = frames[prev].h;
-        const char *src = frames[prev].rgb->data()[0];
-        if (px == 0 && py == 0 && pw == canvas_w && ph == canvas_h)
-          memcpy((char *)dst, (char *)src, canvas_w * canvas_h * 4);
-        else {
-          if ( px + pw > canvas_w ) pw = canvas_w - px;
-          if ( py + ph > canvas_h ) ph = canvas_h - py;
-          for (int y = 0; y < ph; y++) {
-            memcpy(dst + ( y + py ) * canvas_w * 4 + px, src + y * frames[prev].w * 4, pw * 4);
-          }
-        }
-        break;
+  x_ = left;
+  y_ = top;
+  rw_ = right - left;
+  rh_ = bottom - top;
+}
+
+
+static int interlaced_row(int y_, int h_) {
+  // Return the index of image row 'y_' in the pixel data of an
+  // interlaced frame with height 'h_'. The rows are stored in
+  // 4 passes: every 8th row from 0, every 8th from 4,
+  // every 4th from 2 and every 2nd from 1.
+  if (!(y_ & 7))
+    return y_ >> 3;
+  int row = (h_ + 7) >> 3;  // rows in pass 1
+  if (!(y_ & 3))
+    return row + (y_ >> 3);
+  row += (h_ + 3) >> 3;     // rows in pass 2
+  if (!(y_ & 1))
+    return row + (y_ >> 2);
+  row += (h_ + 1) >> 2;     // rows in pass 3
+  return row + (y_ >> 1);
+}
+
+
+static char **index_pixmap(const GIF_WHDR &whdr_, int &count_) {
+  // Return the first frame 'whdr_' as pixmap in the compressed colormap
+  // format of Fl_GIF_Image (canvas-sized, one character per color index
+  // used, transparent pixels and the canvas around the frame map to ' ').
+  // It is made from the color indices as they are, without expanding
+  // the frame, so it has exactly the colors of the frame.
+  int W = whdr_.xdim, H = whdr_.ydim;
+  int frame_x = (unsigned short)whdr_.frxo;
+  int frame_y = (unsigned short)whdr_.fryo;
+  int frame_w = (unsigned short)whdr_.frxd;
+  int frame_h = (unsigned short)whdr_.fryd;
+  int clip_w = frame_x + frame_w <= W ? frame_w : W - frame_x;
+  int clip_h = frame_y + frame_h <= H ? frame_h : H - frame_y;
+  if (W <= 0 || H <= 0 || clip_w < 0 || clip_h < 0)
+    return 0;
+  bool used[256];
+  memset(used, 0, sizeof(used));
+  bool has_transparent = clip_w < W || clip_h < H;
+  for (int row = 0; row < clip_h; row++) {
+    const uchar *src = whdr_.bptr +
+      (whdr_.intr ? interlaced_row(row, frame_h) : row) * frame_w;
+    for (int x = 0; x < clip_w; x++)
+      used[src[x]] = true;
+  }
+  if (whdr_.tran >= 0 && used[whdr_.tran]) {
+    used[whdr_.tran] = false;
+    has_transparent = true;
+  }
+  char chr[256];
+  int numcolors = 0;
+  for (int i = 0; i < 256; i++)
+    if (used[i])
+      chr[i] = (char)(uchar)(' ' + 1 + numcolors++);
+  char outside = ' ';
+  if (has_transparent && numcolors == 256) {
+    // no room for transparency (all colors used, no transparent
+    // color, but the frame does not cover the canvas): the canvas
+    // around the frame gets the background color
+    has_transparent = false;
+    outside = chr[whdr_.bkgd];
+  }
+  if (whdr_.tran >= 0)
+    chr[whdr_.tran] = ' ';
+
+  char **data = new char*[H + 2];
+  for (int y = 0; y < H; y++) {
+    char *line = data[y + 2] = new char[W + 1];
+    memset(line, outside, W);
+    line[W] = 0;
+    if (y < frame_y || y >= frame_y + clip_h)
+      continue;
+    int row = y - frame_y;
+    const uchar *src = whdr_.bptr +
+      (whdr_.intr ? interlaced_row(row, frame_h) : row) * frame_w;
+    for (int x = 0; x < clip_w; x++)
+      line[frame_x + x] = chr[src[x]];
+  }
+
+  // the first line of xpm data and the colormap
+  // (indices outside the color table are black, see composite())
+  char buf[80];
+  int length = snprintf(buf, sizeof(buf), "%d %d %d %d", W, H,
+                        -(numcolors + (has_transparent ? 1 : 0)), 1);
+  data[0] = new char[length + 1];
+  strcpy(data[0], buf);
+  uchar *p = (uchar *)(data[1] = new char[4 * (numcolors + 1)]);
+  if (has_transparent) {
+    *p++ = ' ';
+    *p++ = 0; *p++ = 0; *p++ = 0;
+  }
+  for (int i = 0; i < 256; i++) {
+    if (!used[i])
+      continue;
+    *p++ = (uchar)chr[i];
+    *p++ = i < whdr_.clrs ? whdr_.cpal[i].R : 0;
+    *p++ = i < whdr_.clrs ? whdr_.cpal[i].G : 0;
+    *p++ = i < whdr_.clrs ? whdr_.cpal[i].B : 0;
+  }
+  count_ = H + 2;
+  return data;
+}
+
+
+static char **copy_pixmap(const char * const *data_, int count_) {
+  // Return a copy of the pixmap 'data_' made by index_pixmap().
+  int W = 0, H = 0, colors = 0;
+  if (!data_ || count_ < 2 || sscanf(data_[0], "%d %d %d", &W, &H, &colors) != 3)
+    return 0;
+  char **data = new char*[count_];
+  for (int i = 0; i < count_; i++) {
+    size_t size = i == 1 ? 4 * (size_t)(colors < 0 ? -colors : colors) : strlen(data_[i]) + 1;
+    data[i] = new char[size ? size : 1];
+    memcpy(data[i], data_[i], size);
+  }
+  return data;
+}
+
+
+uchar *Fl_Anim_GIF_Image::FrameInfo::composite(GIF_WHDR &whdr_, Canvas &canvas_,
+                                               bool image_, int &w_, int &h_) {
+  // Composite the decoded frame 'whdr_' onto the offscreen buffer of
+  // 'canvas_' (after disposing the previous frame). If 'image_' is set
+  // return the image of the frame, as it is stored: canvas-sized or
+  // just the frame rectangle with 'optimize_mem'.
+  static bool warn = false;
+  if (!whdr_.ifrm) {
+    // first frame: start with a transparent canvas
+    canvas_.clear();
+    canvas_.w = whdr_.xdim;
+    canvas_.h = whdr_.ydim;
+    canvas_.offscreen = new uchar[canvas_.w * canvas_.h * 4];
+    memset(canvas_.offscreen, 0, canvas_.w * canvas_.h * 4);
+    canvas_.changed_w = canvas_.w;
+    canvas_.changed_h = canvas_.h;
+    warn = &canvas_ == &loader;
+  }
+
+  if (!whdr_.cpal) {
+    // no colors: use default table (Note: whdr_.clrs is at least 2)
+    static struct GIF_WHDR::CPAL defClrs[256];
+    whdr_.cpal = defClrs;
+    if (warn) {
+      Fl::warning("%s does not have a color table, using default.\n", _anim->name());
+      warn = false;
+      memset(defClrs, 0, sizeof(defClrs)); // Note: also sets first color to black
+      defClrs[1].R = defClrs[1].G = defClrs[1].B = 0xff; // white
+      for (int i = 2; i < whdr_.clrs; i++)
+        defClrs[i].R = defClrs[i].G = defClrs[i].B = (uchar)(255 * i / (whdr_.clrs - 1));
+    }
+  }
+
+  // we know now everything we need about the frame..
+  if (whdr_.ifrm) {
+    canvas_.changed_x = canvas_.changed_y = 0;
+    canvas_.changed_w = canvas_.changed_h = 0;
+    dispose(canvas_);
+  }
+
+  // expand the color table to RGBA values
+  // (indices outside the table are black)
+  uint32_t lut[256];
+  for (int i = 0; i < 256; i++) {
+    RGBA_Color color;
+    if (i < whdr_.clrs)
+      color = RGBA_Color(whdr_.cpal[i].R, whdr_.cpal[i].G, whdr_.cpal[i].B);
+    memcpy(&lut[i], &color, 4);
+  }
+
+  // copy image data to offscreen, clipped to the canvas
+  // (interlaced rows are mapped to their image rows on the fly)
+  uchar *offscreen = canvas_.offscreen;
+  int canvas_w = canvas_.w;
+  int canvas_h = canvas_.h;
+  int frame_x = (unsigned short)whdr_.frxo;
+  int frame_y = (unsigned short)whdr_.fryo;
+  int frame_w = (unsigned short)whdr_.frxd;
+  int frame_h = (unsigned short)whdr_.fryd;
+  int clip_w = frame_x + frame_w <= canvas_w ? frame_w : canvas_w - frame_x;
+  int clip_h = frame_y + frame_h <= canvas_h ? frame_h : canvas_h - frame_y;
+  if (whdr_.mode == DISPOSE_PREVIOUS)
+    save_under(canvas_, frame_x, frame_y, clip_w, clip_h);
+  for (int row = 0; row < clip_h && clip_w > 0; row++) {
+    int src_row = whdr_.intr ? interlaced_row(row, frame_h) : row;
+    uint32_t *dst = (uint32_t *)offscreen + (frame_y + row) * canvas_w + frame_x;
+    composite_row(dst, whdr_.bptr + src_row * frame_w, clip_w, lut, whdr_.tran);
+  }
+  add_rect(canvas_.changed_x, canvas_.changed_y, canvas_.changed_w, canvas_.changed_h,
+           frame_x, frame_y, clip_w, clip_h);
+  canvas_.frame_x = frame_x;
+  canvas_.frame_y = frame_y;
+  canvas_.frame_w = clip_w > 0 ? clip_w : 0;
+  canvas_.frame_h = clip_h > 0 ? clip_h : 0;
+  canvas_.next = whdr_.ifrm + 1;
+  canvas_.dispose = (Dispose)whdr_.mode;
+  canvas_.transparent_color_index = whdr_.tran && whdr_.tran < whdr_.clrs ? whdr_.tran : -1;
+  if (canvas_.transparent_color_index >= 0) {
+    canvas_.transparent_color = RGBA_Color(whdr_.cpal[whdr_.tran].R,
+                                           whdr_.cpal[whdr_.tran].G,
+                                           whdr_.cpal[whdr_.tran].B);
+  }
+
+  if (!image_)
+    return 0;
+
+  // create RGB image from offscreen
+  uchar *buf;
+  if (optimize_mem) {
+    uchar *endp = offscreen + canvas_w * canvas_h * 4;
+    buf = new uchar[frame_w * frame_h * 4];
+    if (frame_y + frame_h > canvas_h) // (rows below the canvas are transparent)
+      memset(buf, 0, frame_w * frame_h * 4);
+    uchar *dest = buf;
+    for (int y = frame_y; y < frame_y + frame_h; y++) {
+      for (int x = frame_x; x < frame_x + frame_w; x++) {
+        if (offscreen + y * canvas_w * 4 + x * 4 < endp)
+          memcpy(dest, &offscreen[y * canvas_w * 4 + x * 4], 4);
+        dest += 4;
       }
+    }
+    w_ = frame_w;
+    h_ = frame_h;
+  }
+  else {
+    buf = new uchar[canvas_w * canvas_h * 4];
+    memcpy(buf, offscreen, canvas_w * canvas_h * 4);
+    w_ = canvas_w;
+    h_ = canvas_h;
+  }
+  return buf;
+}
+
+
+void Fl_Anim_GIF_Image::FrameInfo::dispose(Canvas &canvas_) {
+  // dispose the last composited frame of 'canvas_' to its offscreen buffer
+  int frame = (int)canvas_.next - 1;
+  switch (canvas_.dispose) {
+    case DISPOSE_PREVIOUS:
+      DEBUG(("  dispose frame %d to previous frame\n", frame + 1));
+      restore_under(canvas_);
+      break;
     case DISPOSE_BACKGROUND:
-      DEBUG(("  dispose frame %d to background\n", frame_ + 1));
-      setToBackGround(frame_);
+      DEBUG(("  dispose frame %d to background\n", frame + 1));
+      setToBackGround(canvas_);
       break;
 
     default: {
@@ -290,25 +737,97 @@ void Fl_Anim_GIF_Image::FrameInfo::dispose(int frame_) {
 }
 
 
-int Fl_Anim_GIF_Image::FrameInfo::frame_count(char *buf_, long len_) {
-  valid = false;
-  return GIF_Load(buf_, len_, 0, 0, this, 0);
+bool Fl_Anim_GIF_Image::FrameInfo::load(const uchar *buf_, long len_) {
+  // decode GIF using gif_load.h
+  // Note: gif_load does not write to the input data
+  // build the frame index first (this also reads the loop count)..
+  long nfrm = load_index(buf_, len_);
+
+  // frames of the same data already loaded are shared
+  FrameInfo *shared = share ? find_shared(buf_, len_) : 0;
+  if (shared && share_frames(*shared)) {
+    load_done();
+    return valid;
+  }
+
+  // .. else decode the frames through it
+  // (like GIF_Load() loading stops at the first damaged frame)
+  int threads = parallel ? this->threads() : 1;
+  bool decoded = false;
+  if (threads > 1) {
+    // decode in worker threads, composite in order here
+    GifFrameDecoder decoder(buf_, len_, index, nfrm);
+    if (decoder.start(threads)) {
+      DEBUG(("decoding with %d threads\n", threads));
+      for (long i = 0; i < index_size; i++) {
+        GIF_WHDR *whdr = decoder.wait(i);
+        if (!whdr)
+          break;
+        onFrameLoaded(*whdr);
+        decoder.release(i);
+      }
+      decoded = true;
+    }
+  }
+  if (!decoded) // one buffer for all frames
+    GIF_LoadIndexedRange((void *)buf_, len_, cb_gl_frame, this, index, nfrm, 0, index_size);
+  load_done();
+  return valid;
 }
 
 
-bool Fl_Anim_GIF_Image::FrameInfo::load(char *buf_, long len_) {
-  // decode GIF using gif_load.h
+long Fl_Anim_GIF_Image::FrameInfo::load_index(const uchar *buf_, long len_) {
+  // build the frame index, return the frame count from GIF_Index()
   valid = false;
-  GIF_Load(buf_, len_, cb_gl_frame, cb_gl_extension, this, 0);
+  free(index);
+  index = 0;
+  index_size = 0;
+  index_nfrm = 0;
+  duplicates = 0;
+  saved_bytes = 0;
+  long nfrm = GIF_Index((void *)buf_, len_, 0, 0, 0, 0);
+  long n = nfrm < 0 ? -nfrm : nfrm;
+  if (n) {
+    index = (GIF_FIDX *)malloc(n * sizeof(GIF_FIDX));
+    if (!index)
+      return 0;
+    index_size = n;
+    index_nfrm = nfrm;
+    GIF_Index((void *)buf_, len_, cb_gl_extension, this, index, index_size);
+    // (frames merged or not loaded leave some unused)
+    reserve_frames((int)index_size);
+  }
+  DEBUG(("frame index: %ld frames%s\n", n, nfrm < 0 ? " (incomplete)" : ""));
+  return index_nfrm;
+}
 
-  delete[] offscreen;
-  offscreen = 0;
-  return valid;
+
+void Fl_Anim_GIF_Image::FrameInfo::load_done() {
+  // all frames are loaded (or loading failed)
+  pristine = valid;
+  if (duplicates)
+    LOG(("%d duplicate frames, %lu bytes saved\n", duplicates, (unsigned long)saved_bytes));
+  free(by_hash);
+  by_hash = 0;
+  by_hash_size = 0;
+  by_hash_count = 0;
+  if (valid)
+    arm_compress();
+  loader.clear();
+  delete[] previous;
+  previous = 0;
+}
+
+
+int Fl_Anim_GIF_Image::FrameInfo::threads() const {
+  // number of decoder threads to use (not more than frames)
+  int threads = Fl_Anim_GIF_Image::decode_threads > 0 ?
+                Fl_Anim_GIF_Image::decode_threads : GifFrameDecoder::cpus();
+  return threads > index_size ? (int)index_size : threads;
 }
 
 
 void Fl_Anim_GIF_Image::FrameInfo::onFrameLoaded(GIF_WHDR &whdr_) {
-  static bool warn = false;
   if (whdr_.ifrm && !valid) return; // if already invalid, just ignore rest
   int delay = whdr_.time;
   if (delay < 0)
@@ -321,30 +840,20 @@ void Fl_Anim_GIF_Image::FrameInfo::onFrameLoaded(GIF_WHDR &whdr_) {
   if (!whdr_.ifrm) {
     // first frame, get width/height
     valid = true; // may be reset later from loading callback
-    warn = true;
     canvas_w = whdr_.xdim;
     canvas_h = whdr_.ydim;
-    offscreen = new uchar[canvas_w * canvas_h * 4];
-    memset(offscreen, 0, canvas_w * canvas_h * 4);
-  }
-
-  if (!whdr_.cpal) {
-    // no colors: use default table (Note: whdr_.clrs is at least 2)
-    static struct GIF_WHDR::CPAL defClrs[256];
-    whdr_.cpal = defClrs;
-    if (warn) {
-      Fl::warning("%s does not have a color table, using default.\n", _anim->name());
-      warn = false;
-      memset(defClrs, 0, sizeof(defClrs)); // Note: also sets first color to black
-      defClrs[1].R = defClrs[1].G = defClrs[1].B = 0xff; // white
-      for (int i = 2; i < whdr_.clrs; i++)
-        defClrs[i].R = defClrs[i].G = defClrs[i].B = (uchar)(255 * i / (whdr_.clrs - 1));
-    }
   }
 
-  deinterlace(whdr_);
+  // composite the frame and get its image
+  // (this also sets the default color table, if there is none)
+  int w = 0, h = 0;
+  uchar *buf = composite(whdr_, loader, true, w, h);
 
   if (!whdr_.ifrm) {
+    // the base class pixmap (AFTER color table is set)
+    if (!pixmap)
+      pixmap = index_pixmap(whdr_, pixmap_count);
+
     // store background_color AFTER color table is set
     background_color_index = whdr_.clrs && whdr_.bkgd < whdr_.clrs ? whdr_.bkgd : -1;
 
@@ -360,174 +869,1077 @@ void Fl_Anim_GIF_Image::FrameInfo::onFrameLoaded(GIF_WHDR &whdr_) {
   frame.y = whdr_.fryo;
   frame.w = whdr_.frxd;
   frame.h = whdr_.fryd;
+  frame.full_canvas = frame.x == 0 && frame.y == 0 &&
+                      frame.w == canvas_w && frame.h == canvas_h;
+  track_changes(frame);
+  if (optimize_mem) {
+    // just store (and draw) the part of the frame that is not transparent
+    int x = 0, y = 0;
+    buf = crop_transparent(buf, x, y, w, h);
+    frame.x += x;
+    frame.y += y;
+    frame.w = w;
+    frame.h = h;
+    frame.opaque = is_opaque(buf, (size_t)w * h);
+  }
   frame.delay = convertDelay(delay);
-  frame.transparent_color_index = whdr_.tran && whdr_.tran < whdr_.clrs ? whdr_.tran : -1;
   frame.dispose = (Dispose)whdr_.mode;
-  if (frame.transparent_color_index >= 0) {
-    frame.transparent_color = RGBA_Color(whdr_.cpal[frame.transparent_color_index].R,
-                                         whdr_.cpal[frame.transparent_color_index].G,
-                                         whdr_.cpal[frame.transparent_color_index].B);
-  }
+  frame.ifrm = whdr_.ifrm;
+  frame.merged = 1;
   DEBUG(("#%d %d/%d %dx%d delay: %d, dispose: %d transparent_color: %d\n",
     (int)frames_size + 1,
     frame.x, frame.y, frame.w, frame.h,
     delay, whdr_.mode, whdr_.tran));
 
-  // we know now everything we need about the frame..
-  dispose(frames_size - 1);
-
-  // copy image data to offscreen
-  uchar *bits = whdr_.bptr;
-  uchar *endp = offscreen + canvas_w * canvas_h * 4;
-  for (int y = frame.y; y < frame.y + frame.h; y++) {
-    for (int x = frame.x; x < frame.x + frame.w; x++) {
-      uchar c = *bits++;
-      if (c == whdr_.tran)
-        continue;
-      uchar *buf = offscreen;
-      buf += (y * canvas_w * 4 + (x * 4));
-      if (buf >= endp)
+  // store the image
+  if (deltas && !optimize_mem)
+    store_delta(buf);
+  else
+    store_frame(frame, buf, w, h);
+  frame.hash = frame_hash(frame);
+
+  // a frame looking like the last one just extends its delay..
+  if (merge && frames_size && same_frame(frames[frames_size - 1], frame)) {
+    GifFrame &last = frames[frames_size - 1];
+    DEBUG(("  merged into frame #%d\n", frames_size));
+    last.delay += frame.delay;
+    last.merged++;
+    last.dispose = frame.dispose;
+    int x = last.dirty_x, y = last.dirty_y, w = last.dirty_w, h = last.dirty_h;
+    add_rect(x, y, w, h, frame.dirty_x, frame.dirty_y, frame.dirty_w, frame.dirty_h);
+    last.dirty_x = x;
+    last.dirty_y = y;
+    last.dirty_w = w;
+    last.dirty_h = h;
+    duplicates++;
+    saved_bytes += frame_bytes(frame);
+    delete frame.rgb;
+    delete[] frame.pixels;
+    delete[] frame.palette;
+    return;
+  }
+
+  // .. else it uses the data of an identical frame, if there is one
+  bool shared = share_duplicate(frame);
+  if (!push_back_frame(frame) || (optimize_mem && !add_layers(frames_size - 1))) {
+    valid = false;
+    return;
+  }
+  if (!shared)
+    remember_frame(frames_size - 1);
+  if (deltas && !optimize_mem && !frame.delta)
+    keyframe = frames_size - 1; // (a merged frame is not stored, see store_delta())
+  account(0, frame_bytes(frame), !shared);
+  enforce_budget(frames_size - 1);
+}
+
+
+void Fl_Anim_GIF_Image::FrameInfo::onExtensionLoaded(GIF_WHDR &whdr_) {
+  uchar *ext = whdr_.bptr;
+  if (memcmp(ext, "NETSCAPE2.0", 11) == 0 && ext[11] >= 3) {
+    uchar *params = &ext[12];
+    loop_count = params[1] | (params[2] << 8);
+    DEBUG(("netscape loop count: %u\n", loop_count));
+  }
+}
+
+
+bool Fl_Anim_GIF_Image::FrameInfo::push_back_shared(GifFrame &frame_) {
+  // append frame 'frame_' of another animation, sharing its data
+  if (!frame_.refs)
+    frame_.refs = new int(1);
+  if (!push_back_frame(frame_))
+    return false;
+  (*frame_.refs)++;
+  GifFrame &f = frames[frames_size - 1];
+  f.scalable = 0;
+  if (f.pixels) {
+    // the expanded image is not shared
+    f.rgb = 0;
+    f.average_weight = -1;
+    f.desaturated = false;
+  }
+  account(0, data_bytes(f), false);
+  return true;
+}
+
+
+bool Fl_Anim_GIF_Image::FrameInfo::push_back_compressed(const GifFrame &frame_) {
+  // append compressed frame 'frame_' of another animation with a copy
+  // of its data (that is small, so it is not decompressed to share it)
+  Compressed c;
+  memcpy(&c, frame_.compressed, sizeof(c));
+  uchar *compressed = (uchar *)malloc(frame_.compressed_size);
+  if (!compressed || !push_back_frame(frame_)) {
+    free(compressed);
+    return false;
+  }
+  memcpy(compressed, frame_.compressed, frame_.compressed_size);
+  GifFrame &f = frames[frames_size - 1];
+  f.compressed = compressed;
+  f.refs = 0;
+  if (f.palette) {
+    uint32_t *palette = new uint32_t[f.colors ? f.colors : 1];
+    memcpy(palette, f.palette, f.colors * sizeof(uint32_t));
+    f.palette = palette;
+  }
+  account_compressed(f.compressed_size, c.size, true);
+  account(0, frame_bytes(f));
+  return true;
+}
+
+
+bool Fl_Anim_GIF_Image::FrameInfo::push_back_frame(const GifFrame &frame_) {
+  // (the table grows geometrically for a constant cost per frame)
+  if (frames_size == frames_alloc &&
+      !reserve_frames(frames_alloc ? 2 * frames_alloc : 16))
+    return false;
+  memcpy(&frames[frames_size], &frame_, sizeof(GifFrame));
+  frames_size++;
+  return true;
+}
+
+
+bool Fl_Anim_GIF_Image::FrameInfo::reserve_frames(int n_) {
+  // make room for 'n_' frames in 'frames'
+  if (n_ <= frames_alloc)
+    return true;
+  void *tmp = realloc(frames, sizeof(GifFrame) * n_);
+  if (!tmp)
+    return false;
+  frames = (GifFrame *)tmp;
+  frames_alloc = n_;
+  return true;
+}
+
+
+/*static*/
+void Fl_Anim_GIF_Image::FrameInfo::put_pixels(const GifFrame &frame_, uchar *dst_, int dst_w_) {
+  // write the stored pixels of 'frame_' to the RGBA image 'dst_' of width 'dst_w_'
+  uint32_t *dst = (uint32_t *)dst_ + (size_t)frame_.pixels_y * dst_w_ + frame_.pixels_x;
+  frame_.store->expand(frame_, dst, dst_w_);
+}
+
+
+uchar *Fl_Anim_GIF_Image::FrameInfo::reconstruct(int frame_, int &w_, int &h_) {
+  // return a new RGBA image of the delta frame 'frame_': its keyframe
+  // with the changes of all following frames up to 'frame_' applied
+  // (continuing from the last reconstructed frame, if possible)
+  int key = frame_;
+  while (key > 0 && frames[key].delta)
+    key--;
+  w_ = frames[key].pixels_w;
+  h_ = frames[key].pixels_h;
+  size_t size = (size_t)w_ * h_ * 4;
+  if (!recon) {
+    recon = new uchar[size];
+    recon_frame = -1;
+  }
+  int f = recon_frame;
+  if (f < key || f > frame_) {
+    decompress(key);
+    put_pixels(frames[key], recon, w_);
+    f = key;
+  }
+  DEBUG(("reconstruct frame #%d from #%d (keyframe #%d)\n", frame_ + 1, f + 1, key + 1));
+  for (f++; f <= frame_; f++) {
+    decompress(f);
+    put_pixels(frames[f], recon, w_);
+  }
+  recon_frame = frame_;
+  uchar *buf = new uchar[size];
+  memcpy(buf, recon, size);
+  return buf;
+}
+
+
+void Fl_Anim_GIF_Image::FrameInfo::release_rgb(int frame_) {
+  // free the expanded image of an indexed frame
+  if (frames[frame_].scalable)
+    frames[frame_].scalable->release();
+  frames[frame_].scalable = 0;
+  delete frames[frame_].rgb;
+  frames[frame_].rgb = 0;
+}
+
+
+void Fl_Anim_GIF_Image::FrameInfo::resize(int W_, int H_) {
+  pristine = false;
+  double scale_factor_x = (double)W_ / (double)canvas_w;
+  double scale_factor_y = (double)H_ / (double)canvas_h;
+  for (int i=0; i < frames_size; i++) {
+    if (optimize_mem) {
+      frames[i].x = lround(frames[i].x * scale_factor_x);
+      frames[i].y = lround(frames[i].y * scale_factor_y);
+      int new_w = lround(frames[i].w * scale_factor_x);
+      int new_h = lround(frames[i].h * scale_factor_y);
+      frames[i].w = new_w;
+      frames[i].h = new_h;
+    }
+    scale_rect(frames[i].dirty_x, frames[i].dirty_y, frames[i].dirty_w, frames[i].dirty_h,
+               scale_factor_x, scale_factor_y, W_, H_);
+  }
+  canvas_w = W_;
+  canvas_h = H_;
+  if (optimize_mem)
+    build_layers(); // (the rounded rectangles may cover others differently)
+}
+
+
+void Fl_Anim_GIF_Image::FrameInfo::scale_frame(int frame_) {
+  // Do the actual scaling after a resize if neccessary
+  if (!frame_rgb(frame_)) // (indexed frames are scaled after expanding)
+    return;
+  int new_w = optimize_mem ? frames[frame_].w : canvas_w;
+  int new_h = optimize_mem ? frames[frame_].h : canvas_h;
+  if (frames[frame_].scalable &&
+      frames[frame_].scalable->w() == new_w &&
+      frames[frame_].scalable->h() == new_h)
+    return;
+#if !(FL_ABI_VERSION >= 10304 && USE_SHIMAGE_SCALING)
+  else if (frames[frame_].rgb->w() == new_w && frames[frame_].rgb->h() == new_h)
+    return;
+#endif
+
+  Fl_RGB_Scaling old_scaling = Fl_Image::RGB_scaling(); // save current scaling method
+  Fl_Image::RGB_scaling(scaling);
+#if FL_ABI_VERSION >= 10304 && USE_SHIMAGE_SCALING
+  if (!frames[frame_].scalable) {
+    frames[frame_].scalable = Fl_Shared_Image::get(frames[frame_].rgb, 0);
+  }
+  frames[frame_].scalable->scale(new_w, new_h, 0, 1);
+#else
+  replace_rgb(frame_, (Fl_RGB_Image *)frames[frame_].rgb->copy(new_w, new_h));
+#endif
+  Fl_Image::RGB_scaling(old_scaling); // restore scaling method
+}
+
+
+/*static*/
+void Fl_Anim_GIF_Image::FrameInfo::restore_under(Canvas &canvas_) {
+  // restore the area under the last frame (saved by save_under())
+  const uchar *src = canvas_.saved;
+  for (int y = 0; y < canvas_.saved_h; y++) {
+    size_t offs = ((size_t)(canvas_.saved_y + y) * canvas_.w + canvas_.saved_x) * 4;
+    memcpy(canvas_.offscreen + offs, src + (size_t)y * canvas_.saved_w * 4, canvas_.saved_w * 4);
+  }
+  add_rect(canvas_.changed_x, canvas_.changed_y, canvas_.changed_w, canvas_.changed_h,
+           canvas_.saved_x, canvas_.saved_y, canvas_.saved_w, canvas_.saved_h);
+}
+
+
+/*static*/
+void Fl_Anim_GIF_Image::FrameInfo::save_under(Canvas &canvas_, int x_, int y_, int w_, int h_) {
+  // save the area 'x_/y_/w_/h_' of the offscreen buffer of 'canvas_',
+  // that a frame disposed to previous is about to cover (see dispose())
+  // (also one disposed to background, in show())
+  if (w_ < 0) w_ = 0;
+  if (h_ < 0) h_ = 0;
+  size_t size = (size_t)w_ * h_ * 4;
+  if (size > canvas_.saved_alloc) {
+    delete[] canvas_.saved;
+    canvas_.saved = new uchar[size];
+    canvas_.saved_alloc = size;
+  }
+  for (int y = 0; y < h_; y++) {
+    size_t offs = ((size_t)(y_ + y) * canvas_.w + x_) * 4;
+    memcpy(canvas_.saved + (size_t)y * w_ * 4, canvas_.offscreen + offs, w_ * 4);
+  }
+  canvas_.saved_x = x_;
+  canvas_.saved_y = y_;
+  canvas_.saved_w = w_;
+  canvas_.saved_h = h_;
+}
+
+
+void Fl_Anim_GIF_Image::FrameInfo::setToBackGround(Canvas &canvas_) {
+  // reset the rectangle of the last frame to background color
+  int bg = background_color_index;
+  int tp = canvas_.transparent_color_index;
+  DEBUG(("  setToBackGround [%ld] tp = %d, bg = %d\n", canvas_.next - 1, tp, bg));
+  RGBA_Color color = background_color;
+  if (tp >= 0)
+    color = canvas_.transparent_color;
+  if (tp >= 0 && bg >= 0)
+    bg = tp;
+  color.alpha = tp == bg ? T_FULL : tp < 0 ? T_FULL : T_NONE;
+  DEBUG(("  setToColor %d/%d/%d alpha=%d\n", color.r, color.g, color.b, color.alpha));
+  uint32_t c;
+  memcpy(&c, &color, 4);
+  for (int y = 0; y < canvas_.frame_h; y++) {
+    uint32_t *dst = (uint32_t *)canvas_.offscreen + (size_t)(canvas_.frame_y + y) * canvas_.w;
+    fill_row(dst + canvas_.frame_x, canvas_.frame_w, c);
+  }
+  add_rect(canvas_.changed_x, canvas_.changed_y, canvas_.changed_w, canvas_.changed_h,
+           canvas_.frame_x, canvas_.frame_y, canvas_.frame_w, canvas_.frame_h);
+}
+
+
+void Fl_Anim_GIF_Image::FrameInfo::set_frame(int frame_) {
+  // scaling pending? (this also expands indexed frames)
+  scale_frame(frame_);
+  GifFrame &f = frames[frame_];
+  if (!f.rgb)
+    return;
+  bool average = average_weight >= 0 && average_weight < 1 &&
+                 (average_color != f.average_color || average_weight != f.average_weight);
+  bool desaturated = desaturate && !f.desaturated;
+  if ((average || desaturated) && !f.pixels)
+    unshare(frame_); // (an image expanded from pixels is not shared)
+
+  // color average pending?
+  if (average) {
+    f.rgb->color_average(average_color, average_weight);
+    f.average_color = average_color;
+    f.average_weight = average_weight;
+  }
+
+  // desaturate pending?
+  if (desaturated) {
+    f.rgb->desaturate();
+    f.desaturated = true;
+  }
+}
+
+
+Fl_RGB_Image *Fl_Anim_GIF_Image::FrameInfo::show(int frame_) {
+  // Bring the image of 'shown' to frame 'frame_' as draw() shows it
+  // with optimize_mem: the frames since the last full canvas frame
+  // drawn over each other, except those disposed before 'frame_'
+  // (see add_layers()). So the next frame just needs the area under
+  // the last frame restored, if that is disposed (saved before drawing
+  // it), and itself drawn over it, instead of drawing all of them.
+  // Returns 0 if a frame can't be drawn into it (see draw()).
+  if ((int)shown.next == frame_ + 1 && shown_rgb &&
+      shown.w == canvas_w && shown.h == canvas_h)
+    return shown_rgb;
+  const int *list = &frame_;
+  int count = 1;
+  if (shown.offscreen && shown.w == canvas_w && shown.h == canvas_h &&
+      frame_ > 0 && !frames[frame_].full_canvas && (int)shown.next == frame_) {
+    if (shown.dispose == DISPOSE_BACKGROUND || shown.dispose == DISPOSE_PREVIOUS)
+      restore_under(shown);
+  }
+  else {
+    list = layers + frames[frame_].layers;
+    count = frames[frame_].layers_count;
+    if (!shown.offscreen || shown.w != canvas_w || shown.h != canvas_h) {
+      shown.clear();
+      delete shown_rgb;
+      shown_rgb = 0;
+      shown.w = canvas_w;
+      shown.h = canvas_h;
+      shown.offscreen = new uchar[(size_t)canvas_w * canvas_h * 4];
+    }
+    memset(shown.offscreen, 0, (size_t)canvas_w * canvas_h * 4);
+  }
+  shown.next = 0; // (incomplete)
+  for (int i = 0; i < count; i++) {
+    int f = list[i];
+    bool disposed = frames[f].dispose == DISPOSE_BACKGROUND ||
+                    frames[f].dispose == DISPOSE_PREVIOUS;
+    set_frame(f); // (scaled, color averaged, ..)
+    const GifFrame &fr = frames[f];
+    if (!fr.rgb || fr.rgb->w() != fr.w || fr.rgb->h() != fr.h)
+      return 0; // (not scaled to its size, e.g. by a Fl_Shared_Image)
+    if (f == frame_ && disposed)
+      save_under(shown, fr.x, fr.y, fr.x + fr.w <= canvas_w ? fr.w : canvas_w - fr.x,
+                 fr.y + fr.h <= canvas_h ? fr.h : canvas_h - fr.y);
+    draw_over(shown.offscreen, canvas_w, canvas_h, fr.rgb, fr.x, fr.y);
+  }
+  shown.next = frame_ + 1;
+  shown.dispose = frames[frame_].dispose;
+  if (!shown_rgb)
+    shown_rgb = new Fl_RGB_Image(shown.offscreen, canvas_w, canvas_h, 4);
+  else
+    shown_rgb->uncache();
+  return shown_rgb;
+}
+
+
+void Fl_Anim_GIF_Image::FrameInfo::track_changes(GifFrame &frame_) {
+  // Find the area of the canvas, that changed with the frame just
+  // composited, for set_frame() to redraw only that. Just the area
+  // written by composite() needs to be compared with the previous
+  // frame (kept in 'previous'), the first frame changes everything.
+  size_t size = (size_t)canvas_w * canvas_h * 4;
+  const uchar *offscreen = loader.offscreen;
+  if (!previous || !frame_.ifrm) {
+    if (!previous)
+      previous = new uchar[size];
+    memcpy(previous, offscreen, size);
+    frame_.dirty_x = frame_.dirty_y = 0;
+    frame_.dirty_w = canvas_w;
+    frame_.dirty_h = canvas_h;
+    return;
+  }
+  size_t offs = ((size_t)loader.changed_y * canvas_w + loader.changed_x) * 4;
+  int x = 0, y = 0, w = 0, h = 0;
+  changed_rect((const uint32_t *)(previous + offs), (const uint32_t *)(offscreen + offs),
+               canvas_w, loader.changed_w, loader.changed_h, x, y, w, h);
+  for (int row = 0; row < h; row++) {
+    size_t o = ((size_t)(loader.changed_y + y + row) * canvas_w + loader.changed_x + x) * 4;
+    memcpy(previous + o, offscreen + o, w * 4);
+  }
+  frame_.dirty_x = loader.changed_x + x;
+  frame_.dirty_y = loader.changed_y + y;
+  frame_.dirty_w = w;
+  frame_.dirty_h = h;
+}
+
+
+void Fl_Anim_GIF_Image::FrameInfo::store_delta(uchar *buf_) {
+  // store the composited frame 'buf_' as keyframe, or just the area
+  // that changed since the previous frame (see track_changes())
+  int x = frame.dirty_x, y = frame.dirty_y, w = frame.dirty_w, h = frame.dirty_h;
+  int interval = Fl_Anim_GIF_Image::keyframe_interval > 0 ?
+                 Fl_Anim_GIF_Image::keyframe_interval : 1;
+  bool key = frames_size - keyframe >= interval ||
+             (w == canvas_w && h == canvas_h);
+  if (key) {
+    x = y = 0;
+    w = canvas_w;
+    h = canvas_h;
+  }
+  uchar *buf = new uchar[w * h * 4 + 1];
+  for (int row = 0; row < h; row++) {
+    size_t offs = ((size_t)(y + row) * canvas_w + x) * 4;
+    memcpy(buf + (size_t)row * w * 4, buf_ + offs, w * 4);
+  }
+  delete[] buf_;
+  if (!key)
+    DEBUG(("  delta frame %d/%d %dx%d\n", x, y, w, h));
+  store_frame(frame, buf, w, h);
+  frame.pixels_x = x;
+  frame.pixels_y = y;
+  frame.delta = !key;
+}
+
+
+Fl_RGB_Image *Fl_Anim_GIF_Image::FrameInfo::frame_rgb(int frame_) {
+  // return the image of frame 'frame_', frames stored as pixels are
+  // expanded on demand and kept in a cache of the last used frames,
+  // evicted frames are decoded again
+  GifFrame &f = frames[frame_];
+  if (f.evicted && !redecode(frame_))
+    return 0;
+  if (!decompress(frame_))
+    return 0;
+  if (f.delta) {
+    int key = frame_;
+    while (key > 0 && frames[key].delta)
+      key--;
+    if (frames[key].evicted && !redecode(key))
+      return 0;
+  }
+  if (!f.pixels) {
+    enforce_budget(frame_);
+    return f.rgb;
+  }
+  int max = Fl_Anim_GIF_Image::frame_cache > 0 ? Fl_Anim_GIF_Image::frame_cache : 1;
+  if (expanded_alloc < max) {
+    void *tmp = realloc(expanded, max * sizeof(int));
+    if (tmp) {
+      expanded = (int *)tmp;
+      expanded_alloc = max;
+    }
+  }
+  if (max > expanded_alloc)
+    max = expanded_alloc;
+
+  // take the frame out of the cache, then make room for it at the end
+  int i = 0;
+  while (i < expanded_size && expanded[i] != frame_)
+    i++;
+  if (i < expanded_size) {
+    expanded_size--;
+    memmove(&expanded[i], &expanded[i + 1], (expanded_size - i) * sizeof(int));
+  }
+  while (expanded_size > (max > 0 ? max - 1 : 0))
+    drop_expanded(0);
+  if (!f.rgb) {
+    int w = f.pixels_w, h = f.pixels_h;
+    uchar *buf;
+    if (f.delta)
+      buf = reconstruct(frame_, w, h);
+    else {
+      buf = new uchar[(size_t)w * h * 4];
+      put_pixels(f, buf, w);
+    }
+    size_t before = frame_bytes(f);
+    f.rgb = new Fl_RGB_Image(buf, w, h, 4);
+    f.rgb->alloc_array = 1;
+    account(before, frame_bytes(f));
+    // a new image: scaling and effects are applied again by set_frame()
+    f.average_weight = -1;
+    f.desaturated = false;
+  }
+  if (max > 0)
+    expanded[expanded_size++] = frame_;
+  enforce_budget(frame_);
+  return f.rgb;
+}
+
+
+bool Fl_Anim_GIF_Image::FrameInfo::add_layers(int frame_) {
+  // Find the frames that draw() shows for frame 'frame_' (with
+  // optimize_mem) in drawing order: the frames since the last full
+  // canvas frame, that are not disposed before it, but not those
+  // covered by an opaque frame drawn later. That is the list of the
+  // last frame not disposed before it ('layers_base'), without the
+  // frames covered by 'frame_', followed by 'frame_'.
+  GifFrame &f = frames[frame_];
+  int base = -1;
+  if (frame_ > 0 && !f.full_canvas) {
+    const GifFrame &last = frames[frame_ - 1];
+    bool disposed = last.dispose == DISPOSE_BACKGROUND || last.dispose == DISPOSE_PREVIOUS;
+    base = disposed ? last.layers_base : frame_ - 1;
+  }
+  int n = base >= 0 ? frames[base].layers_count + 1 : 1;
+  if (layers_size + n > layers_alloc) {
+    int alloc = layers_alloc ? 2 * layers_alloc : 256;
+    while (alloc < layers_size + n)
+      alloc *= 2;
+    void *tmp = realloc(layers, alloc * sizeof(int));
+    if (!tmp) {
+      f.layers_count = 0; // (nothing drawn)
+      return false;
+    }
+    layers = (int *)tmp;
+    layers_alloc = alloc;
+  }
+  f.layers = layers_size;
+  f.layers_base = base;
+  for (int i = 0; base >= 0 && i < frames[base].layers_count; i++) {
+    int l = layers[frames[base].layers + i];
+    const GifFrame &g = frames[l];
+    if (f.opaque && g.x >= f.x && g.y >= f.y &&
+        g.x + g.w <= f.x + f.w && g.y + g.h <= f.y + f.h)
+      continue;
+    layers[layers_size++] = l;
+  }
+  layers[layers_size++] = frame_;
+  f.layers_count = layers_size - f.layers;
+  return true;
+}
+
+
+void Fl_Anim_GIF_Image::FrameInfo::build_layers() {
+  // find the frames drawn for all frames again (see add_layers())
+  layers_size = 0;
+  for (int i = 0; i < frames_size; i++)
+    add_layers(i);
+}
+
+
+/*static*/
+size_t Fl_Anim_GIF_Image::FrameInfo::frame_bytes(const GifFrame &frame_) {
+  // memory used by the image data of a frame
+  size_t bytes = 0;
+  if (frame_.rgb)
+    bytes += (size_t)frame_.rgb->w() * frame_.rgb->h() * frame_.rgb->d();
+  if (frame_.pixels)
+    bytes += frame_.store->bytes(frame_);
+  if (frame_.palette)
+    bytes += frame_.colors * sizeof(uint32_t);
+  bytes += frame_.compressed_size;
+  return bytes;
+}
+
+
+/*static*/
+size_t Fl_Anim_GIF_Image::FrameInfo::data_bytes(const GifFrame &frame_) {
+  // memory used by the data of a frame that can be shared:
+  // all but an image expanded from stored pixels
+  if (frame_.pixels || !frame_.rgb)
+    return frame_bytes(frame_) -
+           (frame_.rgb ? (size_t)frame_.rgb->w() * frame_.rgb->h() * frame_.rgb->d() : 0);
+  return frame_bytes(frame_);
+}
+
+
+static uint32_t hash_bytes(const uchar *p_, size_t n_, uint32_t hash_) {
+  // FNV-1a hash of 'n_' bytes at 'p_', 32 bits at a time
+  for (; n_ >= 4; p_ += 4, n_ -= 4) {
+    uint32_t word;
+    memcpy(&word, p_, 4);
+    hash_ ^= word;
+    hash_ *= 16777619U;
+  }
+  for (; n_; p_++, n_--) {
+    hash_ ^= *p_;
+    hash_ *= 16777619U;
+  }
+  return hash_;
+}
+
+
+/*static*/
+uint32_t Fl_Anim_GIF_Image::FrameInfo::frame_hash(const GifFrame &frame_) {
+  // hash of the stored data of a frame, to find duplicate frames quickly
+  uint32_t hash = 2166136261U;
+  if (frame_.pixels) {
+    hash = hash_bytes(frame_.pixels, frame_.store->bytes(frame_), hash);
+    if (frame_.palette)
+      hash = hash_bytes((const uchar *)frame_.palette, frame_.colors * sizeof(uint32_t), hash);
+  }
+  else if (frame_.rgb)
+    hash = hash_bytes((const uchar *)frame_.rgb->data()[0],
+                      (size_t)frame_.rgb->w() * frame_.rgb->h() * frame_.rgb->d(), hash);
+  return hash;
+}
+
+
+/*static*/
+bool Fl_Anim_GIF_Image::FrameInfo::same_data(const GifFrame &a_, const GifFrame &b_) {
+  // is the stored data of the frames 'a_' and 'b_' the same?
+  // (delta frames are not compared, their data depends on the frame before)
+  if (a_.hash != b_.hash || a_.delta || b_.delta || a_.evicted || b_.evicted)
+    return false;
+  if (a_.pixels || b_.pixels) {
+    if (!a_.pixels || !b_.pixels || a_.store != b_.store || a_.colors != b_.colors ||
+        a_.pixels_w != b_.pixels_w || a_.pixels_h != b_.pixels_h ||
+        !a_.pixels_w || !a_.pixels_h)
+      return false;
+    if (a_.pixels == b_.pixels)
+      return true;
+    size_t size = a_.store->bytes(a_);
+    return (!a_.palette || !memcmp(a_.palette, b_.palette, a_.colors * sizeof(uint32_t))) &&
+           !memcmp(a_.pixels, b_.pixels, size);
+  }
+  if (!a_.rgb || !b_.rgb || a_.rgb->w() != b_.rgb->w() || a_.rgb->h() != b_.rgb->h() ||
+      a_.rgb->d() != b_.rgb->d())
+    return false;
+  return a_.rgb == b_.rgb ||
+         !memcmp(a_.rgb->data()[0], b_.rgb->data()[0],
+                 (size_t)a_.rgb->w() * a_.rgb->h() * a_.rgb->d());
+}
+
+
+bool Fl_Anim_GIF_Image::FrameInfo::same_frame(const GifFrame &last_, const GifFrame &frame_) const {
+  // does the new frame 'frame_' look like the frame 'last_' before it?
+  // (an empty delta frame does not change anything, with 'optimize_mem'
+  // it must also be drawn at the same place and disposed the same way)
+  if (frame_.delta)
+    return !frame_.pixels_w || !frame_.pixels_h;
+  if (optimize_mem &&
+      (frame_.x != last_.x || frame_.y != last_.y || frame_.w != last_.w ||
+       frame_.h != last_.h || frame_.dispose != last_.dispose ||
+       frame_.full_canvas != last_.full_canvas))
+    return false;
+  return same_data(last_, frame_);
+}
+
+
+void Fl_Anim_GIF_Image::FrameInfo::remember_frame(int frame_) {
+  // add frame 'frame_' to the hash table of the frames loaded so far
+  // (open addressing, kept at most half full)
+  if (frames[frame_].delta)
+    return;
+  if (2 * (by_hash_count + 1) > by_hash_size) {
+    int size = by_hash_size ? 2 * by_hash_size : 64;
+    int *table = (int *)calloc(size, sizeof(int));
+    if (!table)
+      return;
+    for (int i = 0; i < by_hash_size; i++) {
+      if (!by_hash[i])
         continue;
-      *buf++ = whdr_.cpal[c].R;
-      *buf++ = whdr_.cpal[c].G;
-      *buf++ = whdr_.cpal[c].B;
-      *buf = T_NONE;
+      int h = frames[by_hash[i] - 1].hash & (size - 1);
+      while (table[h])
+        h = (h + 1) & (size - 1);
+      table[h] = by_hash[i];
     }
+    free(by_hash);
+    by_hash = table;
+    by_hash_size = size;
   }
+  int h = frames[frame_].hash & (by_hash_size - 1);
+  while (by_hash[h])
+    h = (h + 1) & (by_hash_size - 1);
+  by_hash[h] = frame_ + 1;
+  by_hash_count++;
+}
 
-  // create RGB image from offscreen
-  if (optimize_mem) {
-    uchar *buf = new uchar[frame.w * frame.h * 4];
-    uchar *dest = buf;
-    for (int y = frame.y; y < frame.y + frame.h; y++) {
-      for (int x = frame.x; x < frame.x + frame.w; x++) {
-        if (offscreen + y * canvas_w * 4 + x * 4 < endp)
-          memcpy(dest, &offscreen[y * canvas_w * 4 + x * 4], 4);
-        dest += 4;
-      }
+
+bool Fl_Anim_GIF_Image::FrameInfo::share_duplicate(GifFrame &frame_) {
+  // replace the data of the new frame 'frame_' by a reference to the
+  // data of an earlier frame, if it is the same (see same_data())
+  // (the earlier frames are found by their hash, see remember_frame())
+  int mask = by_hash_size - 1;
+  for (int h = frame_.hash & mask; by_hash_size && by_hash[h]; h = (h + 1) & mask) {
+    int i = by_hash[h] - 1;
+    GifFrame &f = frames[i];
+    if (!same_data(f, frame_))
+      continue;
+    DEBUG(("  same data as frame #%d\n", i + 1));
+    duplicates++;
+    saved_bytes += data_bytes(frame_);
+    delete frame_.rgb;
+    delete[] frame_.pixels;
+    delete[] frame_.palette;
+    if (!f.refs)
+      f.refs = new int(1);
+    (*f.refs)++;
+    frame_.refs = f.refs;
+    frame_.pixels = f.pixels;
+    frame_.palette = f.palette;
+    frame_.colors = f.colors;
+    frame_.store = f.store;
+    frame_.rgb = 0;
+    if (!f.pixels) {
+      // the image is the data (with the effects already applied to it)
+      frame_.rgb = f.rgb;
+      frame_.average_color = f.average_color;
+      frame_.average_weight = f.average_weight;
+      frame_.desaturated = f.desaturated;
     }
-    frame.rgb = new Fl_RGB_Image(buf, frame.w, frame.h, 4);
+    return true;
   }
-  else {
-    uchar *buf = new uchar[canvas_w * canvas_h * 4];
-    memcpy(buf, offscreen, canvas_w * canvas_h * 4);
-    frame.rgb = new Fl_RGB_Image(buf, canvas_w, canvas_h, 4);
+  return false;
+}
+
+
+static uint64_t content_hash_of(const uchar *buf_, long len_) {
+  uint64_t hash = 14695981039346656037ULL; // FNV-1a
+  for (long i = 0; i < len_; i++) {
+    hash ^= buf_[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+
+bool Fl_Anim_GIF_Image::FrameInfo::same_index(const FrameInfo &fi_) const {
+  // return if the frame index of 'fi_' is the same as this one
+  if (fi_.index_nfrm != index_nfrm || fi_.index_size != index_size)
+    return false;
+  for (long i = 0; i < index_size; i++) {
+    const GIF_FIDX &a = index[i];
+    const GIF_FIDX &b = fi_.index[i];
+    if (a.offs != b.offs || a.cpal != b.cpal || a.dlen != b.dlen ||
+        a.clrs != b.clrs || a.tran != b.tran || a.intr != b.intr ||
+        a.mode != b.mode || a.frxd != b.frxd || a.fryd != b.fryd ||
+        a.frxo != b.frxo || a.fryo != b.fryo || a.time != b.time)
+      return false;
+  }
+  return true;
+}
+
+
+Fl_Anim_GIF_Image::FrameInfo *Fl_Anim_GIF_Image::FrameInfo::find_shared(const uchar *buf_, long len_) {
+  // return an animation loaded from the same GIF data 'buf_' with the
+  // same flags, that has all frames still as loaded (0: none)
+  // (the data is hashed only if the size and the frame index match)
+  content_size = len_;
+  content_hashed = false;
+  for (GifFrameCache *c = first(); c; c = c->next()) {
+    FrameInfo *fi = (FrameInfo *)c; // (all animations are FrameInfo's)
+    if (fi == this || !fi->share || !fi->pristine || !fi->valid || fi->async ||
+        fi->content_size != len_ || !fi->frames_size ||
+        fi->frames[fi->frames_size - 1].ifrm + fi->frames[fi->frames_size - 1].merged != fi->index_size ||
+        fi->optimize_mem != optimize_mem || fi->indexed != indexed ||
+        fi->deltas != deltas || fi->merge != merge ||
+        !same_index(*fi))
+      continue;
+    if (!fi->content_hashed) {
+      // (hash the data of the other animation on demand)
+      const GifInput *kept = fi->source ? fi->source : fi->content;
+      if (!kept)
+        continue;
+      fi->content_hash = content_hash_of(kept->data(), kept->size());
+      fi->content_hashed = true;
+      delete fi->content;
+      fi->content = 0;
+    }
+    if (!content_hashed) {
+      content_hash = content_hash_of(buf_, len_);
+      content_hashed = true;
+    }
+    if (fi->content_hash == content_hash)
+      return fi;
+  }
+  return 0;
+}
+
+
+bool Fl_Anim_GIF_Image::FrameInfo::keep_content(GifInput *input_) {
+  // loading is done: make sure the data can be hashed when another
+  // animation with the same size and frame index is loaded, by keeping
+  // the file mapping (it is paged in only then), else by hashing it
+  // now (with a memory limit the data is kept anyway, see 'source');
+  // return true if 'input_' is kept
+  if (!share || !pristine || content_hashed || source)
+    return false;
+  if (input_->mapped()) {
+    delete content;
+    content = input_;
+    return true;
+  }
+  content_hash = content_hash_of(input_->data(), input_->size());
+  content_hashed = true;
+  return false;
+}
+
+
+bool Fl_Anim_GIF_Image::FrameInfo::share_frames(FrameInfo &fi_) {
+  // use the frames of 'fi_' (loaded from the same data) instead of
+  // decoding them: the frame data is shared until it is changed
+  for (int i = 0; i < fi_.frames_size; i++) {
+    if (fi_.frames[i].evicted && !fi_.redecode(i))
+      break;
+    fi_.decompress(i);
+    if (!push_back_shared(fi_.frames[i]))
+      break;
+  }
+  if (frames_size < fi_.frames_size) {
+    while (frames_size > 0)
+      release_frame(--frames_size);
+    return false;
   }
-  frame.rgb->alloc_array = 1;
-
-  if (!push_back_frame(frame)) {
-    valid = false;
+  DEBUG(("sharing %d frames\n", frames_size));
+  if (!pixmap) {
+    pixmap = copy_pixmap(fi_._anim->data(), fi_._anim->count());
+    pixmap_count = pixmap ? fi_._anim->count() : 0;
   }
+  canvas_w = fi_.canvas_w;
+  canvas_h = fi_.canvas_h;
+  if (optimize_mem)
+    build_layers();
+  background_color_index = fi_.background_color_index;
+  background_color = fi_.background_color;
+  valid = fi_.valid;
+  return true;
 }
 
 
-void Fl_Anim_GIF_Image::FrameInfo::onExtensionLoaded(GIF_WHDR &whdr_) {
-  uchar *ext = whdr_.bptr;
-  if (memcmp(ext, "NETSCAPE2.0", 11) == 0 && ext[11] >= 3) {
-    uchar *params = &ext[12];
-    loop_count = params[1] | (params[2] << 8);
-    DEBUG(("netscape loop count: %u\n", loop_count));
+void Fl_Anim_GIF_Image::FrameInfo::unshare(int frame_) {
+  // make the shared data of frame 'frame_' its own (a copy, if
+  // other animations use it), before it is changed
+  GifFrame &f = frames[frame_];
+  if (!f.refs)
+    return;
+  if (*f.refs > 1) {
+    size_t data = data_bytes(f);
+    (*f.refs)--;
+    if (f.pixels) {
+      size_t size = f.store->bytes(f);
+      uchar *pixels = new uchar[size + 1];
+      memcpy(pixels, f.pixels, size);
+      f.pixels = pixels;
+      if (f.palette) {
+        uint32_t *palette = new uint32_t[f.colors ? f.colors : 1];
+        memcpy(palette, f.palette, f.colors * sizeof(uint32_t));
+        f.palette = palette;
+      }
+    }
+    else if (f.rgb) {
+      if (f.scalable) // (refers to the shared image)
+        f.scalable->release();
+      f.scalable = 0;
+      f.rgb = (Fl_RGB_Image *)f.rgb->copy();
+    }
+    account(data, 0, false);
+    account(0, data);
   }
+  else
+    delete f.refs;
+  f.refs = 0;
 }
 
 
-bool Fl_Anim_GIF_Image::FrameInfo::push_back_frame(const GifFrame &frame_) {
-  void *tmp = realloc(frames, sizeof(GifFrame) * (frames_size + 1));
-  if (!tmp) {
-    return false;
+void Fl_Anim_GIF_Image::FrameInfo::release_frame(int frame_) {
+  // free the data of frame 'frame_', if it is shared with other
+  // animations just the reference to it
+  GifFrame &f = frames[frame_];
+  size_t before = frame_bytes(f);
+  size_t data = data_bytes(f);
+  bool last = !f.refs || !--*f.refs;
+  if (f.scalable)
+    f.scalable->release();
+  if (last) {
+    delete f.rgb;
+    delete[] f.pixels;
+    delete[] f.palette;
+    delete f.refs;
+    if (f.compressed) {
+      Compressed c;
+      memcpy(&c, f.compressed, sizeof(c));
+      account_compressed(f.compressed_size, c.size, false);
+      free(f.compressed);
+    }
+    account(before, 0);
   }
-  frames = (GifFrame *)tmp;
-  memcpy(&frames[frames_size], &frame_, sizeof(GifFrame));
-  frames_size++;
-  return true;
+  else {
+    if (f.pixels)
+      delete f.rgb; // (an expanded image is not shared)
+    account(data, 0, false);
+    account(before - data, 0);
+  }
+  f.scalable = 0;
+  f.rgb = 0;
+  f.pixels = 0;
+  f.palette = 0;
+  f.colors = 0;
+  f.store = 0;
+  f.refs = 0;
+  f.compressed = 0;
+  f.compressed_size = 0;
 }
 
 
-void Fl_Anim_GIF_Image::FrameInfo::resize(int W_, int H_) {
-  double scale_factor_x = (double)W_ / (double)canvas_w;
-  double scale_factor_y = (double)H_ / (double)canvas_h;
-  for (int i=0; i < frames_size; i++) {
-    if (optimize_mem) {
-      frames[i].x = lround(frames[i].x * scale_factor_x);
-      frames[i].y = lround(frames[i].y * scale_factor_y);
-      int new_w = lround(frames[i].w * scale_factor_x);
-      int new_h = lround(frames[i].h * scale_factor_y);
-      frames[i].w = new_w;
-      frames[i].h = new_h;
+void Fl_Anim_GIF_Image::FrameInfo::replace_rgb(int frame_, Fl_RGB_Image *rgb_) {
+  // replace the image of frame 'frame_' by 'rgb_' (e.g. a scaled copy)
+  GifFrame &f = frames[frame_];
+  size_t before = frame_bytes(f);
+  if (!f.pixels && f.refs) {
+    // the image is the shared data: release it resp. the reference
+    if (--*f.refs) {
+      account(before, 0, false);
+    }
+    else {
+      delete f.rgb;
+      delete f.refs;
+      account(before, 0);
     }
+    f.refs = 0;
+    before = 0;
   }
-  canvas_w = W_;
-  canvas_h = H_;
+  else
+    delete f.rgb;
+  f.rgb = rgb_;
+  account(before, frame_bytes(f));
 }
 
 
-void Fl_Anim_GIF_Image::FrameInfo::scale_frame(int frame_) {
-  // Do the actual scaling after a resize if neccessary
-  int new_w = optimize_mem ? frames[frame_].w : canvas_w;
-  int new_h = optimize_mem ? frames[frame_].h : canvas_h;
-  if (frames[frame_].scalable &&
-      frames[frame_].scalable->w() == new_w &&
-      frames[frame_].scalable->h() == new_h)
-    return;
-#if !(FL_ABI_VERSION >= 10304 && USE_SHIMAGE_SCALING)
-  else if (frames[frame_].rgb->w() == new_w && frames[frame_].rgb->h() == new_h)
-    return;
-#endif
+//
+// struct Info implementation
+//
 
-  Fl_RGB_Scaling old_scaling = Fl_Image::RGB_scaling(); // save current scaling method
-  Fl_Image::RGB_scaling(scaling);
-#if FL_ABI_VERSION >= 10304 && USE_SHIMAGE_SCALING
-  if (!frames[frame_].scalable) {
-    frames[frame_].scalable = Fl_Shared_Image::get(frames[frame_].rgb, 0);
-  }
-  frames[frame_].scalable->scale(new_w, new_h, 0, 1);
-#else
-  Fl_RGB_Image *copied = (Fl_RGB_Image *)frames[frame_].rgb->copy(new_w, new_h);
-  delete frames[frame_].rgb;
-  frames[frame_].rgb = copied;
-#endif
-  Fl_Image::RGB_scaling(old_scaling); // restore scaling method
+Fl_Anim_GIF_Image::Info::Info() :
+  frame(0) {
+  clear();
 }
 
 
-void Fl_Anim_GIF_Image::FrameInfo::setToBackGround(int frame_) {
-  // reset offscreen to background color
-  int bg = background_color_index;
-  int tp = frame_ >= 0 ? frames[frame_].transparent_color_index : bg;
-  DEBUG(("  setToBackGround [%d] tp = %d, bg = %d\n", frame_, tp, bg));
-  RGBA_Color color = background_color;
-  if (tp >= 0)
-    color = frames[frame_].transparent_color;
-  if (tp >= 0 && bg >= 0)
-    bg = tp;
-  color.alpha = tp == bg ? T_FULL : tp < 0 ? T_FULL : T_NONE;
-  DEBUG(("  setToColor %d/%d/%d alpha=%d\n", color.r, color.g, color.b, color.alpha));
-  for (uchar *p = offscreen + canvas_w * canvas_h * 4 - 4; p >= offscreen; p -= 4)
-    memcpy(p, &color, 4);
+Fl_Anim_GIF_Image::Info::~Info() {
+  clear();
 }
 
 
-void Fl_Anim_GIF_Image::FrameInfo::set_frame(int frame_) {
-  // scaling pending?
-  scale_frame(frame_);
+void Fl_Anim_GIF_Image::Info::clear() {
+  free(frame);
+  frame = 0;
+  frames = 0;
+  canvas_w = 0;
+  canvas_h = 0;
+  global_palette = false;
+  loop_count = 1;
+  duration = 0;
+  complete = false;
+}
 
-  // color average pending?
-  if (average_weight >= 0 && average_weight < 1 &&
-      ((average_color != frames[frame_].average_color) ||
-       (average_weight != frames[frame_].average_weight))) {
-    frames[frame_].rgb->color_average(average_color, average_weight);
-    frames[frame_].average_color = average_color;
-    frames[frame_].average_weight = average_weight;
+
+static const uchar *skip_sub_blocks(const uchar *p_, const uchar *end_) {
+  // skip a sequence of data sub-blocks up to and including the
+  // terminating zero-length block, return 0 if data is exhausted
+  while (p_ < end_) {
+    uchar len = *p_++;
+    if (!len)
+      return p_;
+    p_ += len;
   }
+  return 0;
+}
 
-  // desaturate pending?
-  if (desaturate && !frames[frame_].desaturated) {
-    frames[frame_].rgb->desaturate();
-    frames[frame_].desaturated = true;
+
+/*static*/
+bool Fl_Anim_GIF_Image::probe(const unsigned char *data_, size_t length_,
+                              Info &info_) {
+  // walk through the GIF block structure (like gif_load does for
+  // counting the frames), but skip all image data without decoding
+  info_.clear();
+  const uchar *buf = data_;
+  if (!buf || length_ < 13 || buf[0] !='G' || buf[1] !='I' || buf[2] != 'F')
+    return false;
+  const uchar *end = buf + length_;
+  info_.canvas_w = buf[6] | (buf[7] << 8);
+  info_.canvas_h = buf[8] | (buf[9] << 8);
+  info_.global_palette = (buf[10] & 0x80) != 0;
+  const uchar *p = buf + 13;
+  if (info_.global_palette)
+    p += 3 * (2 << (buf[10] & 7));
+
+  int alloced = 0;
+  int gce_flags = 0;  // graphics control extension values for next frame
+  int gce_delay = 0;
+  int gce_tran = 0;
+  while (p && p < end) {
+    uchar desc = *p++;
+    if (desc == 0x3B) { // trailer
+      info_.complete = true;
+      break;
+    }
+    if (desc == 0x21) { // extension
+      if (p >= end) break;
+      uchar label = *p++;
+      if (label == 0xF9 && p + 5 <= end && p[0] >= 4) {
+        gce_flags = p[1];
+        gce_delay = p[2] | (p[3] << 8);
+        gce_tran = p[4];
+      }
+      else if (label == 0xFF && p + 16 <= end && p[0] == 11 &&
+               memcmp(p + 1, "NETSCAPE2.0", 11) == 0 && p[12] >= 3) {
+        info_.loop_count = p[14] | (p[15] << 8);
+      }
+      p = skip_sub_blocks(p, end);
+    }
+    else if (desc == 0x2C) { // image descriptor
+      if (p + 9 > end) break;
+      Info::Frame frame;
+      frame.x = p[0] | (p[1] << 8);
+      frame.y = p[2] | (p[3] << 8);
+      frame.w = p[4] | (p[5] << 8);
+      frame.h = p[6] | (p[7] << 8);
+      frame.local_palette = (p[8] & 0x80) != 0;
+      frame.interlaced = (p[8] & 0x40) != 0;
+      frame.transparent_index = (gce_flags & 0x01) ? gce_tran : -1;
+      frame.dispose = !(gce_flags & 0x10) ? (gce_flags & 0x0C) >> 2 : GIF_NONE;
+      // same conversion as FrameInfo::convertDelay()
+      int delay = gce_delay > 0 ? gce_delay : info_.loop_count != 1 ? 10 : 0;
+      frame.delay = (double)delay / 100;
+      if (frame.local_palette)
+        p += 3 * (2 << (p[8] & 7));
+      p += 9 + 1; // + min LZW code size
+      if (p > end) break;
+      p = skip_sub_blocks(p, end);
+      if (!p) break;
+      if (info_.frames >= alloced) {
+        alloced = alloced ? alloced * 2 : 16;
+        void *tmp = realloc(info_.frame, alloced * sizeof(Info::Frame));
+        if (!tmp) break;
+        info_.frame = (Info::Frame *)tmp;
+      }
+      info_.frame[info_.frames++] = frame;
+      info_.duration += frame.delay;
+      gce_flags = gce_delay = gce_tran = 0;
+    }
+    else
+      break; // unknown block
   }
+  return info_.frames > 0;
 }
 
 
+/*static*/
+bool Fl_Anim_GIF_Image::probe(const char *name_, Info &info_) {
+  GifInput gif;
+  if (!gif.open(name_)) {
+    info_.clear();
+    return false;
+  }
+  return probe(gif.data(), (size_t)gif.size(), info_);
+}
+
 
 ///////////////////////////////////////////////////////////////////////
 //
@@ -546,11 +1958,27 @@ void Fl_Anim_GIF_Image::FrameInfo::set_frame(int frame_) {
 double Fl_Anim_GIF_Image::min_delay = 0.;
 /*static*/
 bool Fl_Anim_GIF_Image::loop = true;
+/*static*/
+int Fl_Anim_GIF_Image::decode_threads = 0;
+/*static*/
+int Fl_Anim_GIF_Image::frame_cache = 4;
+/*static*/
+int Fl_Anim_GIF_Image::keyframe_interval = 10;
+/*static*/
+size_t Fl_Anim_GIF_Image::memory_budget = 0;
+/*static*/
+double Fl_Anim_GIF_Image::compress_idle = 10.;
 
 //
 //  helper functions
 //
 #include <FL/fl_utf8.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 static char *readin(const char *name_, long &sz_) {
   char *buf = 0;
   struct stat s = {};
@@ -569,6 +1997,70 @@ static char *readin(const char *name_, long &sz_) {
 }
 
 
+bool GifInput::open(const char *name_) {
+  close();
+  if (!name_) { errno = ENOENT; return false; }
+#ifndef _WIN32
+  struct stat s = {};
+  int fd = fl_open(name_, O_RDONLY);
+  if (fd >= 0 && !fstat(fd, &s) && S_ISREG(s.st_mode) && s.st_size > 0) {
+    void *map = mmap(0, (size_t)s.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED) {
+      ::close(fd);
+      _data = (const uchar *)map;
+      _size = (long)s.st_size;
+      _mapped = true;
+      return true;
+    }
+  }
+  if (fd >= 0) ::close(fd);
+#endif
+  // no mapping possible: fall back to reading the file
+  long len = 0;
+  _data = (const uchar *)readin(name_, len);
+  _size = _data ? len : 0;
+  return _data != 0;
+}
+
+
+void GifInput::view(const uchar *data_, long size_) {
+  // use the data of the caller in place (it is not freed by close())
+  close();
+  _data = data_;
+  _size = data_ ? size_ : 0;
+  _viewed = true;
+}
+
+
+bool GifInput::own() {
+  // make sure the data is kept: copy the data of the caller
+  if (!_viewed)
+    return _data != 0;
+  uchar *copied = (uchar *)malloc((size_t)_size);
+  if (!copied)
+    return false;
+  memcpy(copied, _data, (size_t)_size);
+  _data = copied;
+  _viewed = false;
+  return true;
+}
+
+
+void GifInput::close() {
+#ifndef _WIN32
+  if (_mapped)
+    munmap((void *)_data, (size_t)_size);
+  else
+#endif
+  if (!_viewed)
+    free((void *)_data);
+  _data = 0;
+  _size = 0;
+  _mapped = false;
+  _viewed = false;
+}
+
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <FL/Fl_RGB_Image.H>
@@ -593,6 +2085,13 @@ Fl_Anim_GIF_Image::Fl_Anim_GIF_Image(const char *name_,
   _fi(new FrameInfo(this)) {
   _fi->_debug = (flags_ & Log) + 2 * (flags_ & Debug);
   _fi->optimize_mem = (flags_ & OptimizeMemory);
+  _fi->parallel = (flags_ & ParallelDecode);
+  _fi->indexed = (flags_ & IndexedFrames);
+  _fi->deltas = (flags_ & DeltaFrames);
+  _fi->share = (flags_ & SharedFrames);
+  _fi->merge = (flags_ & MergeDuplicates);
+  _fi->pack = (flags_ & PackedFrames);
+  _fi->compress = (flags_ & CompressFrames);
   _valid = load(name_);
   if (canvas_w() && canvas_h()) {
     if (!w() && !h()) {
@@ -606,6 +2105,42 @@ Fl_Anim_GIF_Image::Fl_Anim_GIF_Image(const char *name_,
 }
 
 
+Fl_Anim_GIF_Image::Fl_Anim_GIF_Image(const char *imagename_,
+                                     const unsigned char *data_,
+                                     const size_t length_,
+                                     Fl_Widget *canvas_/* = 0*/,
+                                     unsigned short flags_/* = 0 */) :
+  Inherited(),
+  _name(imagename_ ? strdup(imagename_) : 0),
+  _flags(flags_),
+  _canvas(canvas_),
+  _uncache(false),
+  _valid(false),
+  _frame(-1),
+  _speed(1),
+  _fi(new FrameInfo(this)) {
+  _fi->_debug = (flags_ & Log) + 2 * (flags_ & Debug);
+  _fi->optimize_mem = (flags_ & OptimizeMemory);
+  _fi->parallel = (flags_ & ParallelDecode);
+  _fi->indexed = (flags_ & IndexedFrames);
+  _fi->deltas = (flags_ & DeltaFrames);
+  _fi->share = (flags_ & SharedFrames);
+  _fi->merge = (flags_ & MergeDuplicates);
+  _fi->pack = (flags_ & PackedFrames);
+  _fi->compress = (flags_ & CompressFrames);
+  _valid = load(imagename_, data_, length_);
+  if (canvas_w() && canvas_h()) {
+    if (!w() && !h()) {
+      w(canvas_w());
+      h(canvas_h());
+    }
+  }
+  canvas(canvas_, flags_);
+  if ((flags_ & Start))
+    start();
+}
+
+
 Fl_Anim_GIF_Image::Fl_Anim_GIF_Image() :
   Inherited(),
   _name(0),
@@ -671,6 +2206,13 @@ void Fl_Anim_GIF_Image::cb_animate(void *d_) {
 }
 
 
+/*static*/
+void Fl_Anim_GIF_Image::cb_compress(void *d_) {
+  Fl_Anim_GIF_Image *b = (Fl_Anim_GIF_Image *)d_;
+  b->_fi->idle();
+}
+
+
 void Fl_Anim_GIF_Image::clear_frames() {
   _fi->clear();
   _valid = false;
@@ -679,11 +2221,23 @@ void Fl_Anim_GIF_Image::clear_frames() {
 
 /*virtual*/
 void Fl_Anim_GIF_Image::color_average(Fl_Color c_, float i_) {
+  _fi->pristine = false;
+  _fi->shown.next = 0; // (draw the frames again)
   if (i_ < 0) {
     // immediate mode
     i_ = -i_;
     for (int f=0; f < frames(); f++) {
-      _fi->frames[f].rgb->color_average(c_, i_);
+      _fi->color_average(f, c_, i_);
+    }
+    if (_fi->source) {
+      // remember it for frames decoded again
+      void *tmp = realloc(_fi->averages, (_fi->averages_size + 1) * sizeof(FrameInfo::Average));
+      if (tmp) {
+        _fi->averages = (FrameInfo::Average *)tmp;
+        _fi->averages[_fi->averages_size].color = c_;
+        _fi->averages[_fi->averages_size].weight = i_;
+        _fi->averages_size++;
+      }
     }
     return;
   }
@@ -696,11 +2250,10 @@ void Fl_Anim_GIF_Image::color_average(Fl_Color c_, float i_) {
 Fl_Image *Fl_Anim_GIF_Image::copy(int W_, int H_) {
   Fl_Anim_GIF_Image *copied = new Fl_Anim_GIF_Image();
   // copy/resize the base image (Fl_Pixmap)
-  // Note: this is not really necessary, if the draw()
-  //       method never calls the base class.
-  if (_fi->frames_size) {
-    w(_fi->frames[0].w);
-    h(_fi->frames[0].h);
+  int pixmap_w = 0, pixmap_h = 0;
+  if (data() && sscanf(data()[0], "%d %d", &pixmap_w, &pixmap_h) == 2) {
+    w(pixmap_w);
+    h(pixmap_h);
     Fl_Pixmap *gif = (Fl_Pixmap *)Inherited::copy(W_, H_);
     copied->Inherited::data(gif->data(), gif->count());
     copied->alloc_data = gif->alloc_data;
@@ -745,22 +2298,36 @@ void Fl_Anim_GIF_Image::delay(int frame_, double delay_) {
 
 /*virtual*/
 void Fl_Anim_GIF_Image::desaturate() {
+  _fi->pristine = false;
+  _fi->shown.next = 0; // (draw the frames again)
   _fi->desaturate = true;
 }
 
 
 /*virtual*/
 void Fl_Anim_GIF_Image::draw(int x_, int y_, int w_, int h_, int cx_/* = 0*/, int cy_/* = 0*/) {
+  _fi->touch();
   if (this->image()) {
-    if (_fi->optimize_mem) {
-      int f0 = _frame;
-      while (f0 > 0 && !(_fi->frames[f0].x == 0 && _fi->frames[f0].y == 0 &&
-                       _fi->frames[f0].w == w() && _fi->frames[f0].h == h()))
-        --f0;
-      for (int f = f0; f <= _frame; f++) {
-        if (f < _frame && _fi->frames[f].dispose == FrameInfo::DISPOSE_PREVIOUS) continue;
-        if (f < _frame && _fi->frames[f].dispose == FrameInfo::DISPOSE_BACKGROUND) continue;
-        Fl_RGB_Image *rgb = _fi->frames[f].rgb;
+    // remember where the image is drawn, for set_frame() to damage
+    // just the area changed by the next frame there (that is only
+    // possible if it is drawn at one place in its original size)
+    if (!_fi->placed || _fi->placed_x != x_ - cx_ || _fi->placed_y != y_ - cy_) {
+      _fi->placed++;
+      _fi->placed_x = x_ - cx_;
+      _fi->placed_y = y_ - cy_;
+    }
+    if (w_ != _fi->canvas_w || h_ != _fi->canvas_h)
+      _fi->placed_scaled = true;
+    Fl_RGB_Image *shown = _fi->optimize_mem ? _fi->show(_frame) : 0;
+    if (shown) {
+      // (the frames since the last full canvas frame drawn over each other)
+      shown->draw(x_, y_, w_, h_, cx_, cy_);
+    }
+    else if (_fi->optimize_mem) {
+      const FrameInfo::GifFrame &frame = _fi->frames[_frame];
+      for (int i = 0; i < frame.layers_count; i++) {
+        int f = _fi->layers[frame.layers + i];
+        Fl_RGB_Image *rgb = _fi->frame_rgb(f);
         if (rgb) {
           rgb->draw(x_ + _fi->frames[f].x, y_ + _fi->frames[f].y, w_, h_, cx_, cy_);
         }
@@ -798,12 +2365,16 @@ void Fl_Anim_GIF_Image::frame(int frame_) {
 
 
 int Fl_Anim_GIF_Image::frame_count(const char *name_) {
-  long len = 0;
-  char *buf = readin(name_, len);
-  // decode GIF using gif_load.h
-  int frames = _fi->frame_count(buf, len);
-  free(buf);
-  return frames;
+  Info info;
+  probe(name_, info);
+  return info.frames;
+}
+
+
+int Fl_Anim_GIF_Image::frame_merged(int frame_) const {
+  if (frame_ >= 0 && frame_ < frames())
+    return _fi->frames[frame_].merged;
+  return 0;
 }
 
 
@@ -850,95 +2421,175 @@ int Fl_Anim_GIF_Image::frames() const {
 
 
 Fl_Image *Fl_Anim_GIF_Image::image() const {
-  return _frame >= 0 && _frame < frames() ? _fi->frames[_frame].rgb : 0;
+  return _frame >= 0 && _frame < frames() ? _fi->frame_rgb(_frame) : 0;
 }
 
 
 Fl_Image *Fl_Anim_GIF_Image::image(int frame_) const {
   if (frame_ >= 0 && frame_ < frames())
-    return _fi->frames[frame_].rgb;
+    return _fi->frame_rgb(frame_);
   return 0;
 }
 
 
+bool Fl_Anim_GIF_Image::indexed(int frame_) const {
+  return frame_ >= 0 && frame_ < frames() && _fi->frames[frame_].palette != 0;
+}
+
+
 bool Fl_Anim_GIF_Image::is_animated() const {
-  return _valid && _fi->frames_size > 1;
+  // while loading in the background, the frame index knows better
+  return _valid && (_fi->frames_size > 1 || (loading() && _fi->index_size > 1));
 }
 
 
 /*static*/
 bool Fl_GIF_Image::is_animated(const char *name_) {
-  Fl_Anim_GIF_Image gif;
-  return gif.frame_count(name_);
+  Fl_Anim_GIF_Image::Info info;
+  return Fl_Anim_GIF_Image::probe(name_, info) && info.frames > 1;
 }
 
 
 bool Fl_Anim_GIF_Image::load(const char *name_) {
   DEBUG(("\nFl_Anim_GIF_Image::load '%s'\n", name_));
-  clear_frames();
-  free(_name);
-  _name = name_ ? strdup(name_) : 0;
-
-  // as load() can be called multiple times
-  // we have to replicate the actions of the pixmap destructor here
-  uncache();
-  if (alloc_data) {
-    for (int i = 0; i < count(); i ++) delete[] (char *)data()[i];
-    delete[] (char **)data();
-  }
-  alloc_data = 0;
-  w(0);
-  h(0);
-
-  if (name_) {
-    // load the base class pixmap
-    Fl_GIF_Image tmp(name_);
-    if (tmp.ld() || tmp.w() <= 0 || tmp.h() <= 0 || !tmp.data())
-      return false;
-    Inherited::data(tmp.data(), tmp.count());
-    alloc_data = tmp.alloc_data;
-    tmp.alloc_data = 0;
-    w(tmp.w());
-    h(tmp.h());
-  }
 
-  // read gif file into memory
-  long len = 0;
-  char *buf = readin(name_, len);
-  if (!buf) {
+  // map (or read) gif file into memory
+  GifInput *gif = new GifInput;
+  if (!gif->open(name_)) {
+    delete gif;
+    clear(name_);
     Fl::error("Fl_Anim_GIF: Unable to open '%s': %s\n", name_, strerror(errno));
     ld(ERR_FILE_ACCESS);
-    free(buf);
     return false;
   }
+  return load(name_, gif);
+} // load
 
-  // do own signature checking, to issue proper error/warning msg
-  // (gif_load accepts only 'GIF87a' or 'GIF89a')
-  if (len < 6 || buf[0] !='G' || buf[1] !='I' || buf[2] != 'F') {
-    Fl::error("Fl_GIF_Image: %s is not a GIF file.\n", name_);
+
+bool Fl_Anim_GIF_Image::load(const char *imagename_,
+                             const unsigned char *data_, size_t length_) {
+  DEBUG(("\nFl_Anim_GIF_Image::load '%s' (%lu bytes)\n",
+    imagename_, (unsigned long)length_));
+  GifInput *gif = new GifInput;
+  gif->view(data_, data_ ? (long)length_ : 0);
+  return load(imagename_, gif);
+} // load
+
+
+bool Fl_Anim_GIF_Image::load(const char *imagename_, GifInput *input_) {
+  // load from 'input_' (takes ownership), with a memory limit the
+  // data is kept for decoding evicted frames again
+  clear(imagename_);
+  const char *name_ = imagename_ ? imagename_ : "<data>"; // for messages
+  const uchar *buf = input_->data();
+  long len = input_->size();
+
+  if (!check_signature(name_, buf, len)) {
+    delete input_;
     ld(ERR_FORMAT);
-    free(buf);
     return false;
   }
-  if (buf[3]!='8' || buf[4] >'9' || buf[5] != 'a') {
-    Fl::warning("%s is version %c%c%c.", name_, buf[3], buf [4], buf[5]);
-    memcpy(&buf[3], "89a", 3); // make gif_load happy
+  if (_fi->budgeted() && input_->own()) {
+    _fi->source = input_;
+    buf = input_->data();
   }
 
   // decode GIF using gif_load.h
+  // (the data is used in place, it is neither copied nor modified)
   _fi->load(buf, len);
-  free(buf);
+  if (_fi->source != input_ && !_fi->keep_content(input_))
+    delete input_;
   _frame = _fi->frames_size - 1;
   _valid = _fi->valid;
 
   if (!_valid) {
     Fl::error("Fl_Anim_GIF: %s has invalid format.\n", name_);
     ld(ERR_FORMAT);
+    return false;
   }
+  w(_fi->canvas_w);
+  h(_fi->canvas_h);
+  load_pixmap();
   return _valid;
 } // load
 
 
+bool Fl_Anim_GIF_Image::check_signature(const char *name_, const uchar *buf_, long len_) {
+  // do own signature checking, to issue proper error/warning msg
+  // (gif_load is told to accept any version, see GIF_LAXV)
+  if (len_ < 6 || buf_[0] !='G' || buf_[1] !='I' || buf_[2] != 'F') {
+    Fl::error("Fl_GIF_Image: %s is not a GIF file.\n", name_);
+    return false;
+  }
+  if (buf_[3]!='8' || buf_[4] >'9' || buf_[5] != 'a') {
+    Fl::warning("%s is version %c%c%c.", name_, buf_[3], buf_ [4], buf_[5]);
+  }
+  return true;
+}
+
+
+void Fl_Anim_GIF_Image::clear(const char *name_) {
+  // (loading in the background is stopped without the 'cancelled'
+  // callback, it would be called from the middle of the next load)
+  if (loading())
+    stop_load();
+  clear_frames();
+  free(_name);
+  _name = name_ ? strdup(name_) : 0;
+
+  // as load() can be called multiple times
+  // we have to replicate the actions of the pixmap destructor here
+  uncache();
+  if (alloc_data) {
+    for (int i = 0; i < count(); i ++) delete[] (char *)data()[i];
+    delete[] (char **)data();
+  }
+  alloc_data = 0;
+  Inherited::data(0, 0);
+  w(0);
+  h(0);
+
+  // Note: the base class pixmap is not loaded here, but built
+  //       from the first frame while loading (see load_pixmap()).
+  _valid = false;
+  ld(0);
+} // clear
+
+
+void Fl_Anim_GIF_Image::load_pixmap() {
+  // set the base class pixmap, built from the color indices of the
+  // first frame while loading (see index_pixmap())
+  if (!_fi->pixmap || data())
+    return;
+  Inherited::data((const char **)_fi->pixmap, _fi->pixmap_count);
+  alloc_data = 1;
+  _fi->pixmap = 0;
+  _fi->pixmap_count = 0;
+}
+
+
+Fl_Anim_GIF_Image::Memory Fl_Anim_GIF_Image::memory() const {
+  return _fi->memory;
+}
+
+
+/*static*/
+Fl_Anim_GIF_Image::Memory Fl_Anim_GIF_Image::total_memory() {
+  return FrameInfo::total;
+}
+
+
+void Fl_Anim_GIF_Image::memory_limit(size_t bytes_) {
+  _fi->limit = bytes_;
+  _fi->enforce_budget(-1);
+}
+
+
+size_t Fl_Anim_GIF_Image::memory_limit() const {
+  return _fi->limit;
+}
+
+
 const char *Fl_Anim_GIF_Image::name() const {
   return _name;
 }
@@ -947,6 +2598,11 @@ const char *Fl_Anim_GIF_Image::name() const {
 bool Fl_Anim_GIF_Image::next_frame() {
   int frame(_frame);
   frame++;
+  if (frame >= _fi->frames_size && loading()) {
+    // the next frame is not loaded yet: go on when it is there
+    _fi->waiting = true;
+    return true;
+  }
   if (frame >= _fi->frames_size)  {
     _fi->loop++;
     if (Fl_Anim_GIF_Image::loop && _fi->loop_count > 0 && _fi->loop > _fi->loop_count) {
@@ -982,6 +2638,13 @@ Fl_Anim_GIF_Image& Fl_Anim_GIF_Image::resize(int W_, int H_) {
   if (!W || !H || ((W == w() && H == h()))) {
     return *this;
   }
+  if (loading()) {
+    // the frames are composited in the original size, so
+    // resizing must wait until all frames are there
+    _fi->resize_w = W;
+    _fi->resize_h = H;
+    return *this;
+  }
   _fi->resize(W, H);
   scale_frame(); // scale current frame now
   w(_fi->canvas_w);
@@ -1014,13 +2677,41 @@ void Fl_Anim_GIF_Image::set_frame(int frame_) {
     this->image()->uncache();
 
   _fi->set_frame(_frame);
+  if (_fi->optimize_mem)
+    _fi->show(_frame);
 
+  bool placed = _fi->placed == 1 && !_fi->placed_scaled;
+  _fi->placed = 0;
+  _fi->placed_scaled = false;
   if (canvas()) {
-    canvas()->parent() &&
+    Fl_Widget *widget = canvas()->parent() &&
       (_frame == 0 || (last_frame >= 0 && (_fi->frames[last_frame].dispose == FrameInfo::DISPOSE_BACKGROUND  ||
                                            _fi->frames[last_frame].dispose == FrameInfo::DISPOSE_PREVIOUS))) &&
         (canvas()->box() == FL_NO_BOX || (canvas()->align() && !(canvas()->align() & FL_ALIGN_INSIDE)))      ?
-      canvas()->parent()->redraw() : canvas()->redraw();
+      canvas()->parent() : canvas();
+    // If the last frame is on screen, only the area that changed
+    // since then needs to be redrawn (where the image was drawn,
+    // else the image is drawn at several places resp. scaled, e.g.
+    // by Fl_Tiled_Image or several widgets: redraw it completely)
+    if (!placed || _frame == 0 || last_frame != _frame - 1 ||
+        (_fi->optimize_mem && _fi->frames[_frame].full_canvas)) {
+      widget->redraw();
+      return;
+    }
+    const FrameInfo::GifFrame &f = _fi->frames[_frame];
+    int x = f.dirty_x, y = f.dirty_y, w = f.dirty_w, h = f.dirty_h;
+    if (_fi->optimize_mem) {
+      // (draw() does not show the composited canvas, but draws
+      // the frames since the last full canvas frame over each other)
+      const FrameInfo::GifFrame &l = _fi->frames[last_frame];
+      add_rect(x, y, w, h, f.x, f.y, f.w, f.h);
+      if (l.dispose == FrameInfo::DISPOSE_BACKGROUND || l.dispose == FrameInfo::DISPOSE_PREVIOUS)
+        add_rect(x, y, w, h, l.x, l.y, l.w, l.h);
+    }
+    if (w > 0 && h > 0)
+      widget->damage(FL_DAMAGE_ALL, _fi->placed_x + x, _fi->placed_y + y, w, h);
+    else
+      _fi->placed = 1; // (the screen shows this frame already)
   }
 }
 
@@ -1046,6 +2737,7 @@ bool Fl_Anim_GIF_Image::start() {
 
 bool Fl_Anim_GIF_Image::stop() {
   Fl::remove_timeout(cb_animate, this);
+  _fi->waiting = false;
   return _fi->frames_size != 0;
 }
 
@@ -1062,3 +2754,13 @@ void Fl_Anim_GIF_Image::uncache() {
 bool Fl_Anim_GIF_Image::valid() const {
   return _valid;
 }
+
+
+//
+// The other parts of the implementation: the frame stores, the memory
+// budget and the background loading. Like this unit itself (see the
+// end of Fl_GIF_Image.cxx) they are included here, not compiled alone.
+//
+#include "Fl_Anim_GIF_Image_Store.cxx"
+#include "Fl_Anim_GIF_Image_Cache.cxx"
+#include "Fl_Anim_GIF_Image_Async.cxx"
@@ -0,0 +1,442 @@
+//
+// Copyright 2016-2019 Christian Grabner <wcout@gmx.net>
+//
+// Fl_Anim_GIF_Image class - FLTK animated GIF extension.
+//
+// Fl_Anim_GIF_Image is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation,  either version 3 of the License, or
+// (at your option) any later version.
+//
+// Fl_Anim_GIF_Image is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY;  without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details:
+// http://www.gnu.org/licenses/.
+//
+
+//
+// Fl_Anim_GIF_Image: decoding the frames in worker threads and loading
+// in the background (see load_async()). This part of the implementation
+// is included from Fl_Anim_GIF_Image.cxx.
+//
+
+#include "Fl_Anim_GIF_Image_Private.H"
+
+
+//
+// helper class GifFrameDecoder implementation
+//
+
+GifFrameDecoder::GifFrameDecoder(const uchar *buf_, long len_,
+                                 GIF_FIDX *index_, long nfrm_) :
+  _buf(buf_),
+  _len(len_),
+  _index(index_),
+  _nfrm(nfrm_),
+  _frames(nfrm_ < 0 ? -nfrm_ : nfrm_),
+  _slots(new Slot[_frames]),
+  _next(0),
+  _consumed(0),
+  _ahead(0),
+  _stop(false),
+  _threads(0),
+  _notify(0),
+  _notify_data(0),
+  _notified(false),
+  _thread(0) {
+  memset(_slots, 0, _frames * sizeof(Slot));
+#ifdef _WIN32
+  InitializeCriticalSection(&_mutex);
+  InitializeConditionVariable(&_cond);
+#else
+  pthread_mutex_init(&_mutex, 0);
+  pthread_cond_init(&_cond, 0);
+#endif
+}
+
+
+GifFrameDecoder::~GifFrameDecoder() {
+  stop();
+  delete[] _thread;
+  for (long i = 0; i < _frames; i++)
+    free(_slots[i].whdr.bptr);
+  delete[] _slots;
+#ifdef _WIN32
+  DeleteCriticalSection(&_mutex);
+#else
+  pthread_cond_destroy(&_cond);
+  pthread_mutex_destroy(&_mutex);
+#endif
+}
+
+
+void GifFrameDecoder::notify(int (*cb_)(void *), void *data_) {
+  // set a callback for the workers, called when a frame is done
+  // (once until rearm() is called, returns 0 if successful)
+  _notify = cb_;
+  _notify_data = data_;
+}
+
+
+bool GifFrameDecoder::start(int threads_) {
+  // start the workers, return false if none could be started
+  _ahead = 2 * threads_;
+#ifdef _WIN32
+  _thread = new HANDLE[threads_];
+  for (_threads = 0; _threads < threads_; _threads++) {
+    _thread[_threads] = CreateThread(0, 0, cb_worker, this, 0, 0);
+    if (!_thread[_threads])
+      break;
+  }
+#else
+  _thread = new pthread_t[threads_];
+  for (_threads = 0; _threads < threads_; _threads++) {
+    if (pthread_create(&_thread[_threads], 0, cb_worker, this))
+      break;
+  }
+#endif
+  return _threads > 0;
+}
+
+
+void GifFrameDecoder::stop() {
+  // stop the workers and wait for them to finish
+  lock();
+  _stop = true;
+  wakeup();
+  unlock();
+  for (int i = 0; i < _threads; i++) {
+#ifdef _WIN32
+    WaitForSingleObject(_thread[i], INFINITE);
+    CloseHandle(_thread[i]);
+#else
+    pthread_join(_thread[i], 0);
+#endif
+  }
+  _threads = 0;
+}
+
+
+GIF_WHDR *GifFrameDecoder::wait(long frame_) {
+  // wait until frame 'frame_' is decoded, return 0 if it failed
+  lock();
+  while (_slots[frame_].state == S_PENDING)
+    sleep();
+  unlock();
+  return _slots[frame_].state == S_DONE ? &_slots[frame_].whdr : 0;
+}
+
+
+GifFrameDecoder::State GifFrameDecoder::state(long frame_) {
+  lock();
+  State state = _slots[frame_].state;
+  unlock();
+  return state;
+}
+
+
+void GifFrameDecoder::rearm() {
+  // allow the next notification
+  lock();
+  _notified = false;
+  unlock();
+}
+
+
+void GifFrameDecoder::release(long frame_) {
+  // frame 'frame_' is composited: free its data, let workers go ahead
+  free(_slots[frame_].whdr.bptr);
+  _slots[frame_].whdr.bptr = 0;
+  lock();
+  _consumed = frame_ + 1;
+  wakeup();
+  unlock();
+}
+
+
+/*static*/
+int GifFrameDecoder::cpus() {
+#ifdef _WIN32
+  SYSTEM_INFO si;
+  GetSystemInfo(&si);
+  return (int)si.dwNumberOfProcessors;
+#else
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? (int)n : 1;
+#endif
+}
+
+
+/*static*/
+void GifFrameDecoder::cb_decoded(void *ctx_, GIF_WHDR *whdr_) {
+  // called from GIF_LoadIndexed() in a worker: keep a copy of the
+  // pixel indices, the decoder buffer is freed after the call
+  Slot *slot = (Slot *)ctx_;
+  size_t size = (size_t)whdr_->frxd * whdr_->fryd;
+  slot->whdr = *whdr_;
+  slot->whdr.bptr = (uint8_t *)malloc(size ? size : 1);
+  if (slot->whdr.bptr)
+    memcpy(slot->whdr.bptr, whdr_->bptr, size);
+}
+
+
+/*static*/
+#ifdef _WIN32
+DWORD WINAPI GifFrameDecoder::cb_worker(LPVOID d_) {
+  ((GifFrameDecoder *)d_)->run();
+  return 0;
+}
+#else
+void *GifFrameDecoder::cb_worker(void *d_) {
+  ((GifFrameDecoder *)d_)->run();
+  return 0;
+}
+#endif
+
+
+void GifFrameDecoder::run() {
+  // worker: decode the next frame, until all are done or stopped
+  lock();
+  for (;;) {
+    while (!_stop && _next < _frames && _next >= _consumed + _ahead)
+      sleep();
+    if (_stop || _next >= _frames)
+      break;
+    long frame = _next++;
+    unlock();
+    Slot *slot = &_slots[frame];
+    bool ok = GIF_LoadIndexed((void *)_buf, _len, cb_decoded, slot,
+                              _index, _nfrm, frame) && slot->whdr.bptr;
+    lock();
+    slot->state = ok ? S_DONE : S_FAILED;
+    wakeup();
+    if (_notify && !_notified) {
+      _notified = true;
+      unlock();
+      bool failed = _notify(_notify_data) != 0;
+      lock();
+      if (failed)
+        _notified = false;
+    }
+  }
+  unlock();
+}
+
+
+void GifAsyncLoad::detach() {
+  // stop loading: delete now, or by the pending notification
+  anim = 0;
+  decoder->stop();
+  if (!decoder->notified())
+    delete this;
+}
+
+
+#ifdef _WIN32
+void GifFrameDecoder::lock() { EnterCriticalSection(&_mutex); }
+void GifFrameDecoder::unlock() { LeaveCriticalSection(&_mutex); }
+void GifFrameDecoder::sleep() { SleepConditionVariableCS(&_cond, &_mutex, INFINITE); }
+void GifFrameDecoder::wakeup() { WakeAllConditionVariable(&_cond); }
+#else
+void GifFrameDecoder::lock() { pthread_mutex_lock(&_mutex); }
+void GifFrameDecoder::unlock() { pthread_mutex_unlock(&_mutex); }
+void GifFrameDecoder::sleep() { pthread_cond_wait(&_cond, &_mutex); }
+void GifFrameDecoder::wakeup() { pthread_cond_broadcast(&_cond); }
+#endif
+
+
+/*static*/
+int Fl_Anim_GIF_Image::FrameInfo::cb_notify(void *d_) {
+  // called from a decoder thread of load_async() when frames are done
+  return Fl::awake(Fl_Anim_GIF_Image::cb_async, d_);
+}
+
+
+//
+// class Fl_Anim_GIF_Image: background loading
+//
+
+bool Fl_Anim_GIF_Image::load_async(const char *name_,
+                                   Load_Callback *done_/* = 0*/,
+                                   Load_Callback *cancelled_/* = 0*/,
+                                   void *data_/* = 0*/) {
+  DEBUG(("\nFl_Anim_GIF_Image::load_async '%s'\n", name_));
+  clear(name_);
+  _frame = -1;
+
+  // map (or read) gif file into memory, it is kept until loaded
+  GifAsyncLoad *job = new GifAsyncLoad;
+  if (!job->input->open(name_)) {
+    Fl::error("Fl_Anim_GIF: Unable to open '%s': %s\n", name_, strerror(errno));
+    delete job;
+    ld(ERR_FILE_ACCESS);
+    return false;
+  }
+  const uchar *buf = job->input->data();
+  long len = job->input->size();
+  if (!check_signature(name_, buf, len)) {
+    delete job;
+    ld(ERR_FORMAT);
+    return false;
+  }
+  if (!_fi->load_index(buf, len)) {
+    Fl::error("Fl_Anim_GIF: %s has invalid format.\n", name_);
+    delete job;
+    ld(ERR_FORMAT);
+    return false;
+  }
+  if (_fi->share && _fi->find_shared(buf, len)) {
+    // the frames are there already: share them right now
+    // (from the data read, and 'done_' is called before returning)
+    GifInput *input = job->input;
+    job->input = 0;
+    delete job;
+    bool ok = load(name_, input);
+    if (done_)
+      done_(this, data_);
+    return ok;
+  }
+
+  // decode the frames in the background (at least one thread),
+  // they are composited in the main thread by cb_async()
+  job->decoder = new GifFrameDecoder(buf, len, _fi->index, _fi->index_nfrm);
+  job->decoder->notify(FrameInfo::cb_notify, job);
+  int threads = _fi->parallel ? _fi->threads() : 1;
+  if (!job->decoder->start(threads)) {
+    // no threads: load synchronously instead
+    GifInput *input = job->input;
+    job->input = 0;
+    delete job;
+    bool ok = load(name_, input);
+    if (done_)
+      done_(this, data_);
+    return ok;
+  }
+  DEBUG(("loading with %d threads\n", threads));
+  job->anim = this;
+  job->done = done_;
+  job->cancelled = cancelled_;
+  job->data = data_;
+  _fi->async = job;
+  return true;
+} // load_async
+
+
+/*static*/
+void Fl_Anim_GIF_Image::cb_async(void *d_) {
+  // called in the main thread via Fl::awake() when frames are decoded
+  GifAsyncLoad *job = (GifAsyncLoad *)d_;
+  if (!job->anim) { // loading was stopped meanwhile
+    delete job;
+    return;
+  }
+  job->anim->async_frames();
+}
+
+
+void Fl_Anim_GIF_Image::async_frames() {
+  // composite the frames decoded in the background in order
+  // and append them to the animation
+  GifAsyncLoad *job = _fi->async;
+  GifFrameDecoder *decoder = job->decoder;
+  decoder->rearm();
+  int loaded = frames();
+  bool finished = false;
+  while (!finished && job->next < _fi->index_size) {
+    GifFrameDecoder::State state = decoder->state(job->next);
+    if (state == GifFrameDecoder::S_PENDING)
+      break;
+    if (state == GifFrameDecoder::S_DONE) {
+      _fi->onFrameLoaded(*decoder->frame(job->next));
+      decoder->release(job->next);
+      job->next++;
+    }
+    finished = state == GifFrameDecoder::S_FAILED || !_fi->valid;
+  }
+  if (job->next >= _fi->index_size)
+    finished = true;
+  DEBUG(("async_frames: %d/%ld frames%s\n", frames(), _fi->index_size,
+    finished ? " (finished)" : ""));
+
+  if (!loaded && frames() && _fi->valid) {
+    // the first frame is there: the animation can be displayed
+    _valid = true;
+    w(_fi->canvas_w);
+    h(_fi->canvas_h);
+    load_pixmap();
+    canvas(_canvas, _flags);
+    if (_flags & Start)
+      start();
+  }
+  else if (_fi->waiting && frames() > loaded) {
+    // playback waits for the next frame
+    _fi->waiting = false;
+    next_frame();
+  }
+  if (finished) {
+    Load_Callback *done = job->done;
+    void *data = job->data;
+    load_finished();
+    if (done)
+      done(this, data);
+  }
+}
+
+
+void Fl_Anim_GIF_Image::stop_load() {
+  // detach from loading in the background, the frames loaded so far
+  // are kept (and with a memory limit the GIF data, for decoding them
+  // again), nothing else is done here: no callbacks, no playback
+  GifAsyncLoad *job = _fi->async;
+  job->decoder->stop();
+  if (_fi->budgeted()) {
+    _fi->source = job->input;
+    job->input = 0;
+  }
+  _fi->async = 0;
+  _fi->load_done();
+  if (job->input && _fi->keep_content(job->input))
+    job->input = 0;
+  job->detach();
+  _fi->waiting = false;
+  _fi->resize_w = _fi->resize_h = 0;
+  _valid = _fi->valid && frames();
+}
+
+
+void Fl_Anim_GIF_Image::load_finished() {
+  // all frames are loaded in the background
+  int resize_w = _fi->resize_w, resize_h = _fi->resize_h;
+  bool waiting = _fi->waiting;
+  stop_load();
+  if (!_valid) {
+    Fl::error("Fl_Anim_GIF: %s has invalid format.\n", _name ? _name : "<data>");
+    ld(ERR_FORMAT);
+    return;
+  }
+  if (resize_w && resize_h) {
+    // resize() was called during loading
+    resize(resize_w, resize_h);
+  }
+  if (waiting) {
+    // playback waits for the next frame (resp. the first again)
+    next_frame();
+  }
+}
+
+void Fl_Anim_GIF_Image::cancel_load() {
+  if (!loading())
+    return;
+  DEBUG(("cancel_load: %d/%ld frames\n", frames(), _fi->index_size));
+  Load_Callback *cancelled = _fi->async->cancelled;
+  void *data = _fi->async->data;
+  stop_load();
+  if (cancelled)
+    cancelled(this, data);
+}
+
+
+bool Fl_Anim_GIF_Image::loading() const {
+  return _fi->async != 0;
+}
@@ -0,0 +1,571 @@
+//
+// Copyright 2016-2019 Christian Grabner <wcout@gmx.net>
+//
+// Fl_Anim_GIF_Image class - FLTK animated GIF extension.
+//
+// Fl_Anim_GIF_Image is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation,  either version 3 of the License, or
+// (at your option) any later version.
+//
+// Fl_Anim_GIF_Image is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY;  without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details:
+// http://www.gnu.org/licenses/.
+//
+
+//
+// Fl_Anim_GIF_Image: memory accounting and budget of the animations,
+// eviction of frames, decoding evicted frames again and compression
+// of idle frames. This part of the implementation is included from
+// Fl_Anim_GIF_Image.cxx.
+//
+
+#include "Fl_Anim_GIF_Image_Private.H"
+
+
+//
+// helper class GifFrameCache implementation
+//
+
+/*static*/
+GifFrameCache *GifFrameCache::first_cache = 0;
+/*static*/
+Fl_Anim_GIF_Image::Memory GifFrameCache::total;
+
+
+GifFrameCache::GifFrameCache() :
+  limit(0),
+  next_cache(first_cache),
+  prev_cache(0),
+  exhausted(false) {
+  memset(&memory, 0, sizeof(memory));
+  if (first_cache)
+    first_cache->prev_cache = this;
+  first_cache = this;
+}
+
+
+GifFrameCache::~GifFrameCache() {
+  if (prev_cache)
+    prev_cache->next_cache = next_cache;
+  else
+    first_cache = next_cache;
+  if (next_cache)
+    next_cache->prev_cache = prev_cache;
+}
+
+
+void GifFrameCache::account(size_t before_, size_t after_, bool allocated_/* = true*/) {
+  // update the memory statistics for a change of 'before_' to 'after_' bytes
+  // (not allocated: just references to data shared with other animations)
+  memory.usage = memory.usage - before_ + after_;
+  if (memory.usage > memory.peak)
+    memory.peak = memory.usage;
+  if (!allocated_)
+    return;
+  total.usage = total.usage - before_ + after_;
+  if (total.usage > total.peak)
+    total.peak = total.usage;
+}
+
+
+void GifFrameCache::account_compressed(size_t compressed_, size_t size_, bool added_) {
+  // update the statistics of compressed data for 'compressed_' bytes,
+  // that hold 'size_' bytes uncompressed, being added resp. removed
+  if (added_) {
+    memory.compressed += compressed_;
+    memory.uncompressed += size_;
+    total.compressed += compressed_;
+    total.uncompressed += size_;
+  }
+  else {
+    memory.compressed -= compressed_;
+    memory.uncompressed -= size_;
+    total.compressed -= compressed_;
+    total.uncompressed -= size_;
+  }
+}
+
+
+void GifFrameCache::count_eviction() {
+  memory.evictions++;
+  total.evictions++;
+}
+
+
+void GifFrameCache::count_decode() {
+  memory.decodes++;
+  total.decodes++;
+}
+
+
+bool GifFrameCache::budgeted() const {
+  // is there a memory limit for this animation?
+  return limit || Fl_Anim_GIF_Image::memory_budget;
+}
+
+
+void GifFrameCache::enforce_budget(int pin_) {
+  // evict frames until the memory limit of this animation and the
+  // global memory_budget are kept (as far as possible), but not the
+  // frame 'pin_' (that is just used)
+  while (limit && memory.usage > limit && evict_one(pin_))
+    ;
+  size_t budget = Fl_Anim_GIF_Image::memory_budget;
+  if (!budget || total.usage <= budget)
+    return;
+  GifFrameCache *fi;
+  for (fi = first_cache; fi; fi = fi->next_cache)
+    fi->exhausted = false;
+  while (total.usage > budget) {
+    // evict from animations not playing first, then from the biggest one
+    GifFrameCache *victim = 0;
+    bool victim_playing = false;
+    for (fi = first_cache; fi; fi = fi->next_cache) {
+      if (fi->exhausted || !fi->memory.usage)
+        continue;
+      bool playing = fi->playing();
+      if (!victim ||
+          (victim_playing && !playing) ||
+          (victim_playing == playing && fi->memory.usage > victim->memory.usage)) {
+        victim = fi;
+        victim_playing = playing;
+      }
+    }
+    if (!victim)
+      break;
+    if (!victim->evict_one(victim == this ? pin_ : -1))
+      victim->exhausted = true;
+  }
+}
+
+
+//
+// helper class FrameInfo: eviction and compression of the frames
+//
+
+bool Fl_Anim_GIF_Image::FrameInfo::playing() const {
+  // is the animation playing (evicted last by enforce_budget())?
+  return Fl::has_timeout(Fl_Anim_GIF_Image::cb_animate, _anim) != 0;
+}
+
+
+bool Fl_Anim_GIF_Image::FrameInfo::evict_one(int pin_) {
+  // evict the frame least likely needed soon, return false if there is none
+  int current = _anim->_frame;
+  // expanded images of stored pixels are the cheapest to get again..
+  for (int i = 0; i < expanded_size; i++) {
+    if (expanded[i] != pin_ && expanded[i] != current) {
+      DEBUG(("evict expanded frame #%d\n", expanded[i] + 1));
+      drop_expanded(i);
+      count_eviction();
+      return true;
+    }
+  }
+  if (!source || !frames_size)
+    return false;
+  // .. else evict the frame shown last, counted from the current one
+  // (delta frames are not evicted, they are small anyway, and frames
+  // shared with other animations neither, that would not free them)
+  int n = frames_size;
+  int victim = -1, distance = -1;
+  for (int f = 0; f < n; f++) {
+    const GifFrame &fr = frames[f];
+    if (f == pin_ || f == current || fr.evicted || fr.delta ||
+        (!fr.rgb && !fr.pixels && !fr.compressed) ||
+        (fr.refs && *fr.refs > 1))
+      continue;
+    int d = (f - current - 1 + 2 * n) % n;
+    if (d > distance) {
+      victim = f;
+      distance = d;
+    }
+  }
+  if (victim < 0)
+    return false;
+  evict(victim);
+  return true;
+}
+
+
+void Fl_Anim_GIF_Image::FrameInfo::drop_expanded(int i_) {
+  // release the expanded image of entry 'i_' of the cache 'expanded'
+  int frame = expanded[i_];
+  size_t before = frame_bytes(frames[frame]);
+  release_rgb(frame);
+  account(before, frame_bytes(frames[frame]));
+  expanded_size--;
+  memmove(&expanded[i_], &expanded[i_ + 1], (expanded_size - i_) * sizeof(int));
+}
+
+
+void Fl_Anim_GIF_Image::FrameInfo::evict(int frame_) {
+  // release the data of frame 'frame_', it is decoded again by redecode()
+  GifFrame &f = frames[frame_];
+  size_t before = frame_bytes(f);
+  for (int i = 0; i < expanded_size; i++) {
+    if (expanded[i] == frame_) {
+      expanded_size--;
+      memmove(&expanded[i], &expanded[i + 1], (expanded_size - i) * sizeof(int));
+      break;
+    }
+  }
+  release_frame(frame_);
+  f.evicted = true;
+  if (recon_frame >= frame_)
+    recon_frame = -1;
+  count_eviction();
+  DEBUG(("evict frame #%d (%lu bytes)\n", frame_ + 1, (unsigned long)before));
+}
+
+
+void Fl_Anim_GIF_Image::FrameInfo::release_source() {
+  // free the GIF data and the frame index, if they are shared with
+  // copies of this animation just the reference to them
+  if (!source_refs || !--*source_refs) {
+    delete source_refs;
+    delete source;
+    free(index);
+  }
+  source_refs = 0;
+  source = 0;
+  index = 0;
+  index_size = 0;
+  index_nfrm = 0;
+}
+
+
+/*static*/
+void Fl_Anim_GIF_Image::FrameInfo::cb_gl_replay(void *ctx_, GIF_WHDR *whdr_) {
+  // called from GIF_LoadIndexed() in redecode()
+  FrameInfo *fi = (FrameInfo *)ctx_;
+  bool image = whdr_->ifrm == fi->replay_frame;
+  uchar *buf = fi->composite(*whdr_, fi->replay, image, fi->replay_w, fi->replay_h);
+  if (image)
+    fi->replay_buf = buf;
+}
+
+
+bool Fl_Anim_GIF_Image::FrameInfo::redecode(int frame_) {
+  // decode the evicted frame 'frame_' again from the kept GIF data,
+  // compositing the frames before it (continuing from the last
+  // replayed frame, if possible)
+  // (with merged frames the first GIF frame shown by it)
+  int ifrm = frames[frame_].ifrm;
+  if (!source || ifrm >= index_size)
+    return false;
+  if (replay.next > ifrm)
+    replay.next = 0; // start over (frame 0 resets the canvas)
+  replay_frame = ifrm;
+  replay_buf = 0;
+  for (long i = replay.next; i <= ifrm; i++) {
+    if (!GIF_LoadIndexed((void *)source->data(), source->size(), cb_gl_replay,
+                         this, index, index_nfrm, i))
+      break;
+  }
+  replay_frame = -1;
+  if (!replay_buf)
+    return false;
+  if (optimize_mem) {
+    int x = 0, y = 0; // (the same area as stored by onFrameLoaded())
+    replay_buf = crop_transparent(replay_buf, x, y, replay_w, replay_h);
+  }
+  GifFrame &f = frames[frame_];
+  store_frame(f, replay_buf, replay_w, replay_h);
+  replay_buf = 0;
+  f.evicted = false;
+  for (int i = 0; i < averages_size; i++)
+    color_average(frame_, averages[i].color, averages[i].weight);
+  account(0, frame_bytes(f));
+  count_decode();
+  DEBUG(("redecode frame #%d\n", frame_ + 1));
+  return true;
+}
+
+
+//
+// compression of idle frames: runs of equal pixels and rows equal to
+// the row above (the large uniform areas of GIF images) are stored as
+// a single token, everything else as literal pixels.
+//
+
+enum {
+  RLE_LITERAL = 0,                  // 'count' units follow
+  RLE_RUN = 1,                      // 1 unit follows, repeated 'count' times
+  RLE_ABOVE = 2,                    // copy 'count' units from the row above
+  RLE_TAIL = 3                      // 'count' bytes (not a whole unit) follow
+};
+
+static inline bool same_unit(const uchar *a_, const uchar *b_, int unit_) {
+  switch (unit_) {
+    case 1: return *a_ == *b_;
+    case 3: return !memcmp(a_, b_, 3);
+    case 4: return !memcmp(a_, b_, 4);
+    default: return !memcmp(a_, b_, unit_);
+  }
+}
+
+static uchar *rle_token(uchar *p_, size_t count_, int kind_) {
+  // write a token header (count and kind as variable length number)
+  size_t v = (count_ << 2) | kind_;
+  while (v >= 0x80) {
+    *p_++ = (uchar)(v | 0x80);
+    v >>= 7;
+  }
+  *p_++ = (uchar)v;
+  return p_;
+}
+
+static size_t rle_compress(const uchar *src_, size_t size_, int unit_, int stride_,
+                           uchar *dst_, size_t max_) {
+  // Compress 'size_' bytes of pixels of 'unit_' bytes with rows of
+  // 'stride_' pixels from 'src_' to 'dst_', return the compressed size
+  // or 0 if it would be more than 'max_' bytes.
+  size_t n = size_ / unit_;
+  size_t above = (size_t)stride_;
+  uchar *p = dst_;
+  uchar *end = dst_ + max_ - 16; // (room for a token header)
+  size_t literal = 0;
+  size_t i = 0;
+  while (i <= n) {
+    size_t run = 0, copy = 0;
+    if (i < n) {
+      const uchar *u = src_ + i * unit_;
+      run = 1;
+      while (i + run < n && same_unit(u + run * unit_, u, unit_))
+        run++;
+      if (i >= above) {
+        const uchar *a = u - above * unit_;
+        while (i + copy < n && same_unit(u + copy * unit_, a + copy * unit_, unit_))
+          copy++;
+      }
+      if (run < 4 && copy < 4) {
+        i++;
+        continue;
+      }
+    }
+    if (i > literal) {
+      size_t bytes = (i - literal) * unit_;
+      if (p + bytes >= end)
+        return 0;
+      p = rle_token(p, i - literal, RLE_LITERAL);
+      memcpy(p, src_ + literal * unit_, bytes);
+      p += bytes;
+    }
+    if (i == n)
+      break;
+    if (p + unit_ >= end)
+      return 0;
+    if (copy >= run) {
+      p = rle_token(p, copy, RLE_ABOVE);
+      i += copy;
+    }
+    else {
+      p = rle_token(p, run, RLE_RUN);
+      memcpy(p, src_ + i * unit_, unit_);
+      p += unit_;
+      i += run;
+    }
+    literal = i;
+  }
+  size_t tail = size_ - n * unit_;
+  if (tail) {
+    if (p + tail >= end)
+      return 0;
+    p = rle_token(p, tail, RLE_TAIL);
+    memcpy(p, src_ + n * unit_, tail);
+    p += tail;
+  }
+  return p - dst_;
+}
+
+static void rle_expand(const uchar *src_, size_t len_, uchar *dst_, int unit_, int stride_) {
+  // expand the data compressed by rle_compress() ('len_' bytes at 'src_')
+  const uchar *end = src_ + len_;
+  uchar *p = dst_;
+  size_t above = (size_t)stride_ * unit_;
+  while (src_ < end) {
+    size_t v = 0;
+    int shift = 0;
+    while (*src_ & 0x80) {
+      v |= (size_t)(*src_++ & 0x7f) << shift;
+      shift += 7;
+    }
+    v |= (size_t)*src_++ << shift;
+    size_t count = v >> 2;
+    switch (v & 3) {
+      case RLE_LITERAL:
+        memcpy(p, src_, count * unit_);
+        src_ += count * unit_;
+        p += count * unit_;
+        break;
+      case RLE_RUN: {
+          // fill by doubling the pixels already written
+          size_t bytes = count * unit_;
+          size_t done = unit_;
+          memcpy(p, src_, unit_);
+          src_ += unit_;
+          while (done < bytes) {
+            size_t n = done < bytes - done ? done : bytes - done;
+            memcpy(p + done, p, n);
+            done += n;
+          }
+          p += bytes;
+          break;
+        }
+      case RLE_ABOVE: {
+          // (in pieces of a row, if it overlaps itself)
+          size_t bytes = count * unit_;
+          while (bytes) {
+            size_t n = bytes < above ? bytes : above;
+            memcpy(p, p - above, n);
+            p += n;
+            bytes -= n;
+          }
+          break;
+        }
+      case RLE_TAIL:
+        memcpy(p, src_, count);
+        src_ += count;
+        p += count;
+        break;
+    }
+  }
+}
+
+
+bool Fl_Anim_GIF_Image::FrameInfo::compress_frame(int frame_) {
+  // compress the stored data of frame 'frame_': the pixels (the image
+  // expanded from them is released) resp. the image, return true if
+  // that saved memory
+  GifFrame &f = frames[frame_];
+  if (f.compressed || f.evicted || (f.refs && *f.refs > 1))
+    return false;
+  Compressed c;
+  const uchar *data;
+  int stride;
+  if (f.pixels) {
+    c.image = false;
+    c.w = f.pixels_w;
+    c.h = f.pixels_h;
+    c.d = f.store->depth();
+    c.size = f.store->bytes(f);
+    data = f.pixels;
+    stride = f.pixels_w;
+  }
+  else if (f.rgb && (!f.rgb->ld() || f.rgb->ld() == f.rgb->w() * f.rgb->d())) {
+    c.image = true;
+    c.w = f.rgb->w();
+    c.h = f.rgb->h();
+    c.d = f.rgb->d();
+    c.size = (size_t)c.w * c.h * c.d;
+    data = (const uchar *)f.rgb->data()[0];
+    stride = c.w;
+  }
+  else
+    return false;
+  if (c.size < 256)
+    return false;
+  uchar *buf = (uchar *)malloc(sizeof(c) + c.size);
+  if (!buf)
+    return false;
+  size_t len = rle_compress(data, c.size, c.d, stride, buf + sizeof(c), c.size);
+  if (!len) {
+    free(buf);
+    return false;
+  }
+  memcpy(buf, &c, sizeof(c));
+  uchar *tmp = (uchar *)realloc(buf, sizeof(c) + len);
+  if (tmp)
+    buf = tmp;
+
+  // replace the data by the compressed one
+  for (int i = 0; i < expanded_size; i++) {
+    if (expanded[i] == frame_) {
+      drop_expanded(i);
+      break;
+    }
+  }
+  size_t before = frame_bytes(f);
+  if (f.scalable)
+    f.scalable->release();
+  f.scalable = 0;
+  delete f.rgb;
+  f.rgb = 0;
+  delete[] f.pixels;
+  f.pixels = 0;
+  f.compressed = buf;
+  f.compressed_size = sizeof(c) + len;
+  account_compressed(f.compressed_size, c.size, true);
+  account(before, frame_bytes(f));
+  return true;
+}
+
+
+bool Fl_Anim_GIF_Image::FrameInfo::decompress(int frame_) {
+  // restore the data of frame 'frame_', if it is compressed
+  GifFrame &f = frames[frame_];
+  if (!f.compressed)
+    return true;
+  Compressed c;
+  memcpy(&c, f.compressed, sizeof(c));
+  uchar *data = new uchar[c.size + 1];
+  rle_expand(f.compressed + sizeof(c), f.compressed_size - sizeof(c), data, c.d, c.w);
+  size_t before = frame_bytes(f);
+  if (c.image) {
+    f.rgb = new Fl_RGB_Image(data, c.w, c.h, c.d);
+    f.rgb->alloc_array = 1;
+  }
+  else
+    f.pixels = data;
+  account_compressed(f.compressed_size, c.size, false);
+  free(f.compressed);
+  f.compressed = 0;
+  f.compressed_size = 0;
+  account(before, frame_bytes(f));
+  DEBUG(("decompress frame #%d\n", frame_ + 1));
+  arm_compress(); // (compressed again, when not drawn)
+  return true;
+}
+
+
+void Fl_Anim_GIF_Image::FrameInfo::arm_compress() {
+  // set the timeout for compressing the frames when idle
+  if (!compress || compress_armed || Fl_Anim_GIF_Image::compress_idle <= 0)
+    return;
+  Fl::add_timeout(Fl_Anim_GIF_Image::compress_idle, Fl_Anim_GIF_Image::cb_compress, _anim);
+  compress_armed = true;
+}
+
+
+void Fl_Anim_GIF_Image::FrameInfo::idle() {
+  // called compress_idle seconds after arm_compress(): compress the
+  // frames, if the animation was not drawn meanwhile (it is stopped
+  // or not visible), but not the current one
+  compress_armed = false;
+  if (drawn) {
+    drawn = false;
+    arm_compress();
+    return;
+  }
+  if (async)
+    return;
+  size_t before = memory.usage;
+  int n = 0;
+  for (int i = 0; i < frames_size; i++) {
+    if (i != _anim->_frame && compress_frame(i))
+      n++;
+  }
+  if (n)
+    LOG(("compressed %d frames: %lu => %lu bytes\n", n,
+         (unsigned long)before, (unsigned long)memory.usage));
+}
+
+
+void Fl_Anim_GIF_Image::FrameInfo::touch() {
+  // the animation is drawn: it is not idle
+  drawn = true;
+  arm_compress();
+}
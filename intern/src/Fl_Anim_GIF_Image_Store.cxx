@@ -0,0 +1,307 @@
+//
+// Copyright 2016-2019 Christian Grabner <wcout@gmx.net>
+//
+// Fl_Anim_GIF_Image class - FLTK animated GIF extension.
+//
+// Fl_Anim_GIF_Image is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation,  either version 3 of the License, or
+// (at your option) any later version.
+//
+// Fl_Anim_GIF_Image is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY;  without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details:
+// http://www.gnu.org/licenses/.
+//
+
+//
+// Fl_Anim_GIF_Image: the encodings of the stored pixels of the frames
+// (see FrameStore). This part of the implementation is included from
+// Fl_Anim_GIF_Image.cxx.
+//
+
+#include "Fl_Anim_GIF_Image_Private.H"
+
+
+static int index_colors(const uint32_t *src_, long n_, uchar *dst_, uint32_t *palette_) {
+  // Map the 'n_' RGBA pixels of 'src_' to indices into the table of
+  // their colors 'palette_' (room for 256), return the number of colors
+  // or -1 if there are more than 256. The index of a color is found in
+  // a small hash table, runs of the same color need no lookup at all.
+  short slot[1024];
+  memset(slot, -1, sizeof(slot));
+  int colors = 0;
+  uint32_t last = 0;
+  int last_index = -1;
+  for (long i = 0; i < n_; i++) {
+    uint32_t c = src_[i];
+    if (c != last || last_index < 0) {
+      unsigned h = (c * 2654435761u) >> 22;
+      while (slot[h] >= 0 && palette_[slot[h]] != c)
+        h = (h + 1) & 1023;
+      if (slot[h] < 0) {
+        if (colors == 256)
+          return -1;
+        palette_[colors] = c;
+        slot[h] = (short)colors++;
+      }
+      last = c;
+      last_index = slot[h];
+    }
+    dst_[i] = (uchar)last_index;
+  }
+  return colors;
+}
+
+
+static uchar *pack_pixels(const uchar *src_, long n_, bool &masked_) {
+  // Return the 'n_' RGBA pixels of 'src_' as RGB pixels, followed by a
+  // mask with a bit set for each transparent pixel if there are any
+  // ('masked_'), or 0 if there is alpha other than opaque or transparent.
+  masked_ = false;
+  for (long i = 0; i < n_; i++) {
+    uchar alpha = src_[i * 4 + 3];
+    if (alpha != 0xff) {
+      if (alpha)
+        return 0;
+      masked_ = true;
+    }
+  }
+  uchar *pixels = new uchar[n_ * 3 + (masked_ ? (n_ + 7) / 8 : 0) + 1];
+  uchar *mask = pixels + n_ * 3;
+  if (masked_)
+    memset(mask, 0, (n_ + 7) / 8);
+  for (long i = 0; i < n_; i++, src_ += 4) {
+    memcpy(pixels + i * 3, src_, 3);
+    if (masked_ && !src_[3])
+      mask[i >> 3] |= (uchar)(1 << (i & 7));
+  }
+  return pixels;
+}
+
+
+//
+// FrameStore for color indices with a palette (IndexedFrames)
+//
+class Fl_Anim_GIF_Image::FrameInfo::IndexedStore : public FrameStore {
+public:
+  bool store(GifFrame &frame_, uchar *buf_, int w_, int h_) const;
+  void expand(const GifFrame &frame_, uint32_t *dst_, int stride_) const;
+  void color_average(GifFrame &frame_, Fl_Color c_, float i_) const;
+  size_t bytes(const GifFrame &frame_) const;
+  int depth() const { return 1; }
+};
+
+
+bool Fl_Anim_GIF_Image::FrameInfo::IndexedStore::store(GifFrame &frame_, uchar *buf_,
+                                                       int w_, int h_) const {
+  // (not possible with more than 256 colors)
+  uchar *pixels = new uchar[(size_t)w_ * h_ + 1];
+  uint32_t palette[256];
+  int colors = index_colors((const uint32_t *)buf_, (long)w_ * h_, pixels, palette);
+  if (colors < 0) {
+    delete[] pixels;
+    return false;
+  }
+  frame_.pixels = pixels;
+  frame_.palette = new uint32_t[colors ? colors : 1];
+  memcpy(frame_.palette, palette, colors * sizeof(uint32_t));
+  frame_.colors = colors;
+  frame_.store = this;
+  delete[] buf_;
+  return true;
+}
+
+
+void Fl_Anim_GIF_Image::FrameInfo::IndexedStore::expand(const GifFrame &frame_, uint32_t *dst_,
+                                                        int stride_) const {
+  for (int y = 0; y < frame_.pixels_h; y++) {
+    const uchar *src = frame_.pixels + (size_t)y * frame_.pixels_w;
+    uint32_t *dst = dst_ + (size_t)y * stride_;
+    for (int x = 0; x < frame_.pixels_w; x++)
+      dst[x] = frame_.palette[src[x]];
+  }
+}
+
+
+void Fl_Anim_GIF_Image::FrameInfo::IndexedStore::color_average(GifFrame &frame_, Fl_Color c_,
+                                                               float i_) const {
+  // (just the color table is changed)
+  if (!frame_.colors)
+    return;
+  Fl_RGB_Image colors((const uchar *)frame_.palette, frame_.colors, 1, 4);
+  colors.color_average(c_, i_);
+  memcpy(frame_.palette, colors.data()[0], frame_.colors * 4);
+}
+
+
+size_t Fl_Anim_GIF_Image::FrameInfo::IndexedStore::bytes(const GifFrame &frame_) const {
+  return (size_t)frame_.pixels_w * frame_.pixels_h;
+}
+
+
+//
+// FrameStore for RGB pixels, with a mask of the transparent pixels
+// if there are any (PackedFrames)
+//
+class Fl_Anim_GIF_Image::FrameInfo::PackedStore : public FrameStore {
+public:
+  PackedStore(bool masked_) : masked(masked_) {}
+  bool store(GifFrame &frame_, uchar *buf_, int w_, int h_) const;
+  void expand(const GifFrame &frame_, uint32_t *dst_, int stride_) const;
+  void color_average(GifFrame &frame_, Fl_Color c_, float i_) const;
+  size_t bytes(const GifFrame &frame_) const;
+  int depth() const { return 3; }
+private:
+  bool masked;                      // flag if the pixels are followed by the mask
+};
+
+
+bool Fl_Anim_GIF_Image::FrameInfo::PackedStore::store(GifFrame &frame_, uchar *buf_,
+                                                      int w_, int h_) const {
+  // (not possible with alpha other than opaque or transparent,
+  // the pixels are stored by 'masked_store' if there is a mask)
+  bool has_mask;
+  uchar *pixels = pack_pixels(buf_, (long)w_ * h_, has_mask);
+  if (!pixels)
+    return false;
+  frame_.pixels = pixels;
+  frame_.store = has_mask ? &masked_store : &packed_store;
+  delete[] buf_;
+  return true;
+}
+
+
+void Fl_Anim_GIF_Image::FrameInfo::PackedStore::expand(const GifFrame &frame_, uint32_t *dst_,
+                                                       int stride_) const {
+  const uchar *mask = masked ?
+    frame_.pixels + (size_t)frame_.pixels_w * frame_.pixels_h * 3 : 0;
+  for (int y = 0; y < frame_.pixels_h; y++) {
+    size_t i = (size_t)y * frame_.pixels_w;
+    const uchar *src = frame_.pixels + i * 3;
+    uchar *d = (uchar *)(dst_ + (size_t)y * stride_);
+    for (int x = 0; x < frame_.pixels_w; x++, i++, src += 3, d += 4) {
+      memcpy(d, src, 3);
+      d[3] = mask && (mask[i >> 3] & (1 << (i & 7))) ? T_FULL : T_NONE;
+    }
+  }
+}
+
+
+void Fl_Anim_GIF_Image::FrameInfo::PackedStore::color_average(GifFrame &frame_, Fl_Color c_,
+                                                              float i_) const {
+  // (the transparency mask is not changed)
+  if (!frame_.pixels_w || !frame_.pixels_h)
+    return;
+  Fl_RGB_Image pixels(frame_.pixels, frame_.pixels_w, frame_.pixels_h, 3);
+  pixels.color_average(c_, i_);
+  memcpy(frame_.pixels, pixels.data()[0], (size_t)frame_.pixels_w * frame_.pixels_h * 3);
+}
+
+
+size_t Fl_Anim_GIF_Image::FrameInfo::PackedStore::bytes(const GifFrame &frame_) const {
+  size_t n = (size_t)frame_.pixels_w * frame_.pixels_h;
+  return n * 3 + (masked ? (n + 7) / 8 : 0);
+}
+
+
+//
+// FrameStore for RGBA pixels (delta frames and their keyframes)
+//
+class Fl_Anim_GIF_Image::FrameInfo::RgbaStore : public FrameStore {
+public:
+  bool store(GifFrame &frame_, uchar *buf_, int w_, int h_) const;
+  void expand(const GifFrame &frame_, uint32_t *dst_, int stride_) const;
+  void color_average(GifFrame &frame_, Fl_Color c_, float i_) const;
+  size_t bytes(const GifFrame &frame_) const;
+  int depth() const { return 4; }
+};
+
+
+bool Fl_Anim_GIF_Image::FrameInfo::RgbaStore::store(GifFrame &frame_, uchar *buf_,
+                                                    int, int) const {
+  // (the image itself, not as Fl_RGB_Image: that may be changed by
+  // scaling and color effects)
+  frame_.pixels = buf_;
+  frame_.store = this;
+  return true;
+}
+
+
+void Fl_Anim_GIF_Image::FrameInfo::RgbaStore::expand(const GifFrame &frame_, uint32_t *dst_,
+                                                     int stride_) const {
+  for (int y = 0; y < frame_.pixels_h; y++)
+    memcpy(dst_ + (size_t)y * stride_, frame_.pixels + (size_t)y * frame_.pixels_w * 4,
+           frame_.pixels_w * 4);
+}
+
+
+void Fl_Anim_GIF_Image::FrameInfo::RgbaStore::color_average(GifFrame &frame_, Fl_Color c_,
+                                                            float i_) const {
+  if (!frame_.pixels_w || !frame_.pixels_h)
+    return;
+  Fl_RGB_Image pixels(frame_.pixels, frame_.pixels_w, frame_.pixels_h, 4);
+  pixels.color_average(c_, i_);
+  memcpy(frame_.pixels, pixels.data()[0], (size_t)frame_.pixels_w * frame_.pixels_h * 4);
+}
+
+
+size_t Fl_Anim_GIF_Image::FrameInfo::RgbaStore::bytes(const GifFrame &frame_) const {
+  return (size_t)frame_.pixels_w * frame_.pixels_h * 4;
+}
+
+
+/*static*/
+const Fl_Anim_GIF_Image::FrameInfo::IndexedStore Fl_Anim_GIF_Image::FrameInfo::indexed_store;
+/*static*/
+const Fl_Anim_GIF_Image::FrameInfo::PackedStore Fl_Anim_GIF_Image::FrameInfo::packed_store(false);
+/*static*/
+const Fl_Anim_GIF_Image::FrameInfo::PackedStore Fl_Anim_GIF_Image::FrameInfo::masked_store(true);
+/*static*/
+const Fl_Anim_GIF_Image::FrameInfo::RgbaStore Fl_Anim_GIF_Image::FrameInfo::rgba_store;
+
+
+void Fl_Anim_GIF_Image::FrameInfo::store_frame(GifFrame &frame_, uchar *buf_, int w_, int h_) {
+  // store the composited RGBA image 'buf_' in 'frame_' (takes ownership):
+  // as color indices if requested and possible, packed as RGB image resp.
+  // RGB pixels with transparency mask if requested, as RGBA pixels for
+  // delta frames, else as image (see FrameStore)
+  frame_.rgb = 0;
+  frame_.scalable = 0;
+  frame_.pixels = 0;
+  frame_.palette = 0;
+  frame_.colors = 0;
+  frame_.pixels_x = 0;
+  frame_.pixels_y = 0;
+  frame_.pixels_w = w_;
+  frame_.pixels_h = h_;
+  frame_.store = 0;
+  frame_.delta = false;
+  frame_.refs = 0;
+  // a new image: scaling and effects are applied again by set_frame()
+  frame_.average_weight = -1;
+  frame_.desaturated = false;
+  bool delta_pixels = deltas && !optimize_mem;
+  if (indexed) {
+    if (indexed_store.store(frame_, buf_, w_, h_))
+      return;
+    LOG(("frame has more than 256 colors, stored as %s\n", pack ? "RGB" : "RGBA"));
+  }
+  if (pack && packed_store.store(frame_, buf_, w_, h_)) {
+    if (frame_.store == &packed_store && !delta_pixels) {
+      // opaque: an image without alpha channel
+      frame_.rgb = new Fl_RGB_Image(frame_.pixels, w_, h_, 3);
+      frame_.rgb->alloc_array = 1;
+      frame_.pixels = 0;
+      frame_.store = 0;
+    }
+    return;
+  }
+  if (delta_pixels) {
+    rgba_store.store(frame_, buf_, w_, h_);
+    return;
+  }
+  frame_.rgb = new Fl_RGB_Image(buf_, w_, h_, 4);
+  frame_.rgb->alloc_array = 1;
+}
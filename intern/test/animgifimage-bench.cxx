@@ -0,0 +1,319 @@
+//
+//  Benchmark program for loading animated GIF files
+//  with the Fl_Anim_GIF_Image class.
+//
+//  animgifimage-bench [-n count] [-m] [-x] [-d] [-k] [-s] [-b bytes] [-g] [-p] [-i] [-t threads] [-f] files...
+//
+//  -n count: load every file 'count' times (default: 10)
+//  -m:       load with the 'OptimizeMemory' flag
+//  -x:       load with the 'IndexedFrames' flag
+//  -d:       load with the 'DeltaFrames' flag
+//  -k:       load with the 'PackedFrames' flag
+//  -s:       load with the 'SharedFrames' flag, while the file is
+//            loaded once more (so every load shares its frames)
+//  -b bytes: set the memory_budget to 'bytes' and report the peak memory
+//            and the frames decoded again for getting all frames twice
+//  -g:       also time the classic Fl_GIF_Image (first frame only) loader
+//  -p:       also time Fl_Anim_GIF_Image::probe() (no image decoding)
+//  -i:       compare interlaced and progressive decoding: every file is
+//            loaded from memory twice, with the interlace flag of all
+//            frames set resp. cleared (the image data is the same, just
+//            the row order differs)
+//  -t threads: measure the scaling of loading with the 'ParallelDecode'
+//            flag for 1 up to 'threads' decoder threads and check that
+//            all frames are the same as when loaded without the flag
+//  -f:       measure the load time per frame of generated animations
+//            with 10 up to 10000 frames (it should not depend on the
+//            frame count), no files needed
+//
+//  Example: animgifimage-bench testsuite/*.gif
+//
+#include <FL/Fl_Anim_GIF_Image.H>
+#include <FL/Fl_GIF_Image.H>
+#include <FL/Fl_RGB_Image.H>
+#include <FL/Fl.H>
+#include <FL/filename.H>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/time.h>
+
+static double now() {
+  struct timeval tv;
+  gettimeofday(&tv, 0);
+  return tv.tv_sec + tv.tv_usec / 1000000.;
+}
+
+static unsigned char *readin(const char *name_, size_t &len_) {
+  unsigned char *buf = 0;
+  FILE *f = fopen(name_, "rb");
+  if (!f) return buf;
+  fseek(f, 0, SEEK_END);
+  len_ = (size_t)ftell(f);
+  fseek(f, 0, SEEK_SET);
+  buf = (unsigned char *)malloc(len_);
+  if (buf && fread(buf, 1, len_, f) != len_) {
+    free(buf);
+    buf = 0;
+  }
+  fclose(f);
+  return buf;
+}
+
+static void set_interlaced(unsigned char *buf_, size_t len_, bool interlaced_) {
+  // walk the GIF block structure and set/clear the interlace
+  // flag in all image descriptors
+  if (len_ < 13) return;
+  unsigned char *p = buf_ + 13;
+  unsigned char *end = buf_ + len_;
+  if (buf_[10] & 0x80)
+    p += 3 * (2 << (buf_[10] & 7));
+  while (p < end && *p != 0x3B) {
+    unsigned char desc = *p++;
+    if (desc == 0x2C) {
+      if (p + 9 > end) return;
+      if (interlaced_)
+        p[8] |= 0x40;
+      else
+        p[8] &= ~0x40;
+      if (p[8] & 0x80)
+        p += 3 * (2 << (p[8] & 7));
+      p += 9;
+    }
+    else if (desc != 0x21)
+      return;
+    p++; // extension label or LZW code size
+    while (p < end && *p)
+      p += *p + 1;
+    p++;
+  }
+}
+
+static unsigned char *make_gif(int frames_, size_t &len_) {
+  // generate a 16x16 animation of 'frames_' frames: a single white
+  // pixel moving over the canvas (each frame disposed to background)
+  static const unsigned char header[] = {
+    'G', 'I', 'F', '8', '9', 'a', 16, 0, 16, 0, 0x80, 0, 0,
+    0, 0, 0, 0xff, 0xff, 0xff                     // color table
+  };
+  static const unsigned char frame[] = {
+    0x21, 0xF9, 4, 0x08, 2, 0, 0, 0,              // dispose to background, 2/100 s
+    0x2C, 0, 0, 0, 0, 1, 0, 1, 0, 0,              // 1x1 image at (0/0)
+    2, 2, 0x4C, 0x01, 0                           // LZW: clear, 1, end
+  };
+  len_ = sizeof(header) + frames_ * sizeof(frame) + 1;
+  unsigned char *buf = (unsigned char *)malloc(len_);
+  unsigned char *p = buf;
+  memcpy(p, header, sizeof(header));
+  p += sizeof(header);
+  for (int i = 0; i < frames_; i++) {
+    memcpy(p, frame, sizeof(frame));
+    p[9] = (unsigned char)(i % 16);               // x position
+    p[11] = (unsigned char)(i / 16 % 16);         // y position
+    p += sizeof(frame);
+  }
+  *p = 0x3B;
+  return buf;
+}
+
+static double load_from_memory(const char *name_, const unsigned char *buf_,
+                               size_t len_, int count_, unsigned short flags_) {
+  double t0 = now();
+  for (int c = 0; c < count_; c++) {
+    Fl_Anim_GIF_Image animgif(name_, buf_, len_, 0, flags_);
+  }
+  return (now() - t0) / count_ * 1000.;
+}
+
+static bool same_frames(Fl_Anim_GIF_Image &a_, Fl_Anim_GIF_Image &b_) {
+  // compare all frame images of two animations
+  if (a_.frames() != b_.frames())
+    return false;
+  for (int f = 0; f < a_.frames(); f++) {
+    Fl_Image *a = a_.image(f);
+    Fl_Image *b = b_.image(f);
+    if (a->w() != b->w() || a->h() != b->h() || a->d() != b->d() ||
+        a_.frame_x(f) != b_.frame_x(f) || a_.frame_y(f) != b_.frame_y(f) ||
+        a_.delay(f) != b_.delay(f) ||
+        memcmp(a->data()[0], b->data()[0], (size_t)a->w() * a->h() * a->d()))
+      return false;
+  }
+  return true;
+}
+
+int main(int argc_, char *argv_[]) {
+  int count = 10;
+  bool classic = false;
+  bool probe = false;
+  bool interlace = false;
+  int threads = 0;
+  bool frame_cost = false;
+  long budget = -1;
+  unsigned short flags = 0;
+  int n = 0;
+  for (int i = 1; i < argc_; i++) {
+    if (!strcmp(argv_[i], "-n") && i + 1 < argc_)
+      count = atoi(argv_[++i]);
+    else if (!strcmp(argv_[i], "-m"))
+      flags |= Fl_Anim_GIF_Image::OptimizeMemory;
+    else if (!strcmp(argv_[i], "-x"))
+      flags |= Fl_Anim_GIF_Image::IndexedFrames;
+    else if (!strcmp(argv_[i], "-d"))
+      flags |= Fl_Anim_GIF_Image::DeltaFrames;
+    else if (!strcmp(argv_[i], "-k"))
+      flags |= Fl_Anim_GIF_Image::PackedFrames;
+    else if (!strcmp(argv_[i], "-s"))
+      flags |= Fl_Anim_GIF_Image::SharedFrames;
+    else if (!strcmp(argv_[i], "-b") && i + 1 < argc_)
+      budget = atol(argv_[++i]);
+    else if (!strcmp(argv_[i], "-g"))
+      classic = true;
+    else if (!strcmp(argv_[i], "-p"))
+      probe = true;
+    else if (!strcmp(argv_[i], "-i"))
+      interlace = true;
+    else if (!strcmp(argv_[i], "-t") && i + 1 < argc_)
+      threads = atoi(argv_[++i]);
+    else if (!strcmp(argv_[i], "-f"))
+      frame_cost = true;
+    else if (argv_[i][0] != '-')
+      n++;
+  }
+  if (frame_cost && count > 0) {
+    printf("%-10s %10s %14s\n", "frames", "load [ms]", "per frame [us]");
+    for (int frames = 10; frames <= 10000; frames *= 10) {
+      size_t len = 0;
+      unsigned char *buf = make_gif(frames, len);
+      double t = load_from_memory("generated", buf, len, count, flags);
+      printf("%-10d %10.3f %14.3f\n", frames, t, t * 1000. / frames);
+      free(buf);
+    }
+    if (!n)
+      return 0;
+  }
+  if (!n || count <= 0) {
+    fprintf(stderr, "Usage: %s [-n count] [-m] [-x] [-d] [-k] [-s] [-b bytes] [-g] [-p] [-i] [-t threads] [-f] files...\n", argv_[0]);
+    exit(0);
+  }
+
+  if (budget >= 0)
+    Fl_Anim_GIF_Image::memory_budget = (size_t)budget;
+
+  printf("%-40s %6s %10s", "file", "frames", "load [ms]");
+  if (budget >= 0)
+    printf(" %10s %10s %10s", "get [ms]", "peak [KB]", "decodes");
+  if (classic)
+    printf(" %10s", "gif [ms]");
+  if (probe)
+    printf(" %10s", "probe [ms]");
+  if (interlace)
+    printf(" %10s %10s", "prog [ms]", "intr [ms]");
+  for (int t = 1; t <= threads; t++) {
+    char title[20];
+    snprintf(title, sizeof(title), "%dT [ms]", t);
+    printf(" %10s", title);
+  }
+  if (threads > 0)
+    printf(" %s", "check");
+  printf("\n");
+  double total = 0;
+  double total_classic = 0;
+  double total_probe = 0;
+  double total_prog = 0;
+  double total_intr = 0;
+  double *total_threads = new double[threads + 1];
+  for (int t = 0; t <= threads; t++)
+    total_threads[t] = 0;
+  for (int i = 1; i < argc_; i++) {
+    if (!strcmp(argv_[i], "-n") || !strcmp(argv_[i], "-t") || !strcmp(argv_[i], "-b")) { i++; continue; }
+    if (argv_[i][0] == '-') continue;
+    const char *name = argv_[i];
+    int frames = 0;
+    Fl_Anim_GIF_Image *shared = 0;
+    if (flags & Fl_Anim_GIF_Image::SharedFrames)
+      shared = new Fl_Anim_GIF_Image(name, 0, flags);
+    double t0 = now();
+    for (int c = 0; c < count; c++) {
+      Fl_Anim_GIF_Image animgif(name, 0, flags);
+      frames = animgif.frames();
+    }
+    double t = (now() - t0) / count * 1000.;
+    total += t;
+    delete shared;
+    printf("%-40s %6d %10.3f", fl_filename_name(name), frames, t);
+    if (budget >= 0) {
+      Fl_Anim_GIF_Image animgif(name, 0, flags);
+      t0 = now();
+      for (int f = 0; f < 2 * animgif.frames(); f++)
+        animgif.image(f % animgif.frames());
+      t = (now() - t0) * 1000.;
+      Fl_Anim_GIF_Image::Memory memory = animgif.memory();
+      printf(" %10.3f %10lu %10lu", t, (unsigned long)(memory.peak / 1024), memory.decodes);
+    }
+    if (classic) {
+      t0 = now();
+      for (int c = 0; c < count; c++) {
+        Fl_GIF_Image gif(name);
+      }
+      t = (now() - t0) / count * 1000.;
+      total_classic += t;
+      printf(" %10.3f", t);
+    }
+    if (probe) {
+      t0 = now();
+      for (int c = 0; c < count; c++) {
+        Fl_Anim_GIF_Image::Info info;
+        Fl_Anim_GIF_Image::probe(name, info);
+      }
+      t = (now() - t0) / count * 1000.;
+      total_probe += t;
+      printf(" %10.3f", t);
+    }
+    if (interlace) {
+      size_t len = 0;
+      unsigned char *buf = readin(name, len);
+      if (buf) {
+        set_interlaced(buf, len, false);
+        t = load_from_memory(name, buf, len, count, flags);
+        total_prog += t;
+        printf(" %10.3f", t);
+        set_interlaced(buf, len, true);
+        t = load_from_memory(name, buf, len, count, flags);
+        total_intr += t;
+        printf(" %10.3f", t);
+        free(buf);
+      }
+    }
+    if (threads > 0) {
+      bool same = true;
+      Fl_Anim_GIF_Image serial(name, 0, flags);
+      for (int th = 1; th <= threads; th++) {
+        Fl_Anim_GIF_Image::decode_threads = th;
+        t0 = now();
+        for (int c = 0; c < count; c++) {
+          Fl_Anim_GIF_Image animgif(name, 0,
+            (unsigned short)(flags | Fl_Anim_GIF_Image::ParallelDecode));
+          if (!c && !same_frames(serial, animgif))
+            same = false;
+        }
+        t = (now() - t0) / count * 1000.;
+        total_threads[th] += t;
+        printf(" %10.3f", t);
+      }
+      printf(" %s", same ? "ok" : "DIFFERENT");
+    }
+    printf("\n");
+  }
+  printf("%-40s %6s %10.3f", "total", "", total);
+  if (classic)
+    printf(" %10.3f", total_classic);
+  if (probe)
+    printf(" %10.3f", total_probe);
+  if (interlace)
+    printf(" %10.3f %10.3f", total_prog, total_intr);
+  for (int t = 1; t <= threads; t++)
+    printf(" %10.3f", total_threads[t]);
+  printf("\n");
+  delete[] total_threads;
+  return 0;
+}
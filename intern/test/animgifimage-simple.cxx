@@ -2,13 +2,41 @@
 //  Minimal program for displaying an animated GIF file
 //  with the Fl_Anim_GIF_Image class.
 //
+//  animgifimage-simple file [-a]
+//
+//  -a: load the file in the background (playback starts
+//      with the first frame, while the others are loading)
+//
 #include <FL/Fl_Anim_GIF_Image.H>
 #include <FL/Fl_Box.H>
 #include <FL/Fl_Double_Window.H>
 #include <FL/Fl.H>
 #include <cstdio>
+#include <cstring>
+
+static void cb_loaded(Fl_Anim_GIF_Image *animgif_, void *) {
+  printf("loaded - valid: %d frames: %d\n", animgif_->valid(), animgif_->frames());
+}
 
 int main(int argc_, char *argv_[]) {
+  if (argc_ > 2 && !strcmp(argv_[2], "-a")) {
+    Fl::lock(); // the loader threads use Fl::awake()
+    Fl_Double_Window win(800, 600, "animated (background load)");
+    Fl_Box canvas(0, 0, win.w(), win.h());
+    win.resizable(win);
+    win.end();
+    win.show();
+
+    // the flags for the animation are taken from canvas(),
+    // the animation starts as soon as the first frame is loaded
+    Fl_Anim_GIF_Image animgif;
+    animgif.canvas(&canvas, Fl_Anim_GIF_Image::Start |
+                            Fl_Anim_GIF_Image::DontResizeCanvas);
+    if (animgif.load_async(argv_[1], cb_loaded))
+      return Fl::run();
+    return 1;
+  }
+
   Fl_Double_Window win(800, 600, "animated");
 
   // prepare a canvas for the animation
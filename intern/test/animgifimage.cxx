@@ -38,6 +38,20 @@ static void cb_forced_redraw(void *d_) {
     Fl::repeat_timeout(RedrawDelay, cb_forced_redraw);
 }
 
+// a canvas that draws its image twice side by side (see flag 'P'):
+// both copies must show the current frame
+class Twice_Box : public Fl_Box {
+public:
+  Twice_Box(int x_, int y_, int w_, int h_) : Fl_Box(x_, y_, w_, h_) {}
+  void draw() {
+    draw_box();
+    if (image()) {
+      image()->draw(x(), y());
+      image()->draw(x() + image()->w(), y());
+    }
+  }
+};
+
 Fl_Window *openFile(const char *name_, char *flags_, bool close_ = false) {
   // determine test options from 'flags_'
   bool uncache = strchr(flags_, 'u');
@@ -49,6 +63,7 @@ Fl_Window *openFile(const char *name_, char *flags_, bool close_ = false) {
   bool average = strchr(flags_, 'A');
   bool test_tiles = strchr(flags_, 'T');
   bool test_forced_redraw = strchr(flags_, 'f');
+  bool test_twice = !test_tiles && strchr(flags_, 'P');
   bool resizable = !test_tiles && strchr(flags_, 'r');
 
   // setup window
@@ -62,7 +77,9 @@ Fl_Window *openFile(const char *name_, char *flags_, bool close_ = false) {
     optimize_mem ? " (optimized)" : "");
 
   // create a canvas for the animation
-  Fl_Box *canvas = test_tiles ? 0 : new Fl_Box(0, 0, 0, 0); // canvas will be resized by animation
+  Fl_Box *canvas = test_tiles ? 0 :
+                   test_twice ? new Twice_Box(0, 0, 0, 0) :
+                   new Fl_Box(0, 0, 0, 0); // canvas will be resized by animation
   unsigned short flags = debug ? Fl_Anim_GIF_Image::Log : 0;
   if (debug > 1)
     flags |= Fl_Anim_GIF_Image::Debug;
@@ -95,6 +112,11 @@ Fl_Window *openFile(const char *name_, char *flags_, bool close_ = false) {
       group->align(FL_ALIGN_INSIDE);
       animgif->canvas(group, Fl_Anim_GIF_Image::DontResizeCanvas | Fl_Anim_GIF_Image::DontSetAsImage );
       win->resizable(group);
+    } else if (test_twice) {
+      // the animation is drawn at two places of its canvas,
+      // so every frame must redraw both of them
+      W *= 2;
+      canvas->size(W, H);
     } else {
       // demonstrate a way how to use same animation in another canvas simultaneously:
       // as the current implementation allows only automatic redraw of one canvas..
@@ -218,7 +240,7 @@ int main(int argc_, char *argv_[]) {
              "   filename [-{flags}] open single file [with options] \n"
              "   No arguments open a fileselector\n"
              "   {flags} can be: d=debug mode, u=uncached, D=desaturated, A=color averaged, T=tiled\n"
-             "                   m=minimal update, r=resized\n"
+             "                   m=minimal update, r=resized, P=drawn twice in one canvas\n"
              "   Use keys '+'/'-' to change speed of the active image.\n", testsuite);
       exit(1);
     }
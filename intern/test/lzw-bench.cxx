@@ -0,0 +1,175 @@
+//
+//  Benchmark program for the LZW decoders of gif_load.h
+//
+//  lzw-bench [-n count] files...
+//
+//  -n count: decode every file 'count' times (default: 10)
+//
+//  Every frame of a file is decoded by the original decoder
+//  (_GIF_LoadFrame) and the fast decoder (_GIF_LoadFrameFast).
+//  The results (return value, remaining size, stream position and
+//  all bytes of the frame buffer) are checked to be identical and
+//  the decoding speed is printed in MB of pixel data per second.
+//
+//  Example: lzw-bench testsuite/*.gif
+//
+#define GIF_EXTR  // don't make GIF_Load() static (unused here)
+#include "gif_load.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/time.h>
+
+static double now() {
+  struct timeval tv;
+  gettimeofday(&tv, 0);
+  return tv.tv_sec + tv.tv_usec / 1000000.;
+}
+
+static unsigned char *readin(const char *name_, long &len_) {
+  unsigned char *buf = 0;
+  FILE *f = fopen(name_, "rb");
+  if (!f) return buf;
+  fseek(f, 0, SEEK_END);
+  len_ = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  buf = (unsigned char *)malloc(len_);
+  if (buf && fread(buf, 1, len_, f) != (size_t)len_) {
+    free(buf);
+    buf = 0;
+  }
+  fclose(f);
+  return buf;
+}
+
+struct Frame {
+  unsigned char *data;  // LZW minimum code size byte
+  long size;            // remaining size of file from 'data'
+  long pixels;          // frame width * height
+};
+
+static int find_frames(unsigned char *buf_, long len_, Frame *frames_, int max_) {
+  // walk the GIF block structure and collect the image data positions
+  int n = 0;
+  if (len_ < 13) return n;
+  unsigned char *p = buf_ + 13;
+  unsigned char *end = buf_ + len_;
+  if (buf_[10] & 0x80)
+    p += 3 * (2 << (buf_[10] & 7));
+  while (p < end && *p != 0x3B && n < max_) {
+    unsigned char desc = *p++;
+    if (desc == 0x2C) {
+      if (p + 9 > end) break;
+      long w = p[4] | (p[5] << 8);
+      long h = p[6] | (p[7] << 8);
+      if (p[8] & 0x80)
+        p += 3 * (2 << (p[8] & 7));
+      p += 9;
+      if (p >= end) break;
+      frames_[n].data = p;
+      frames_[n].size = (long)(end - p);
+      frames_[n].pixels = w * h;
+      n++;
+    }
+    else if (desc != 0x21)
+      break;
+    p++; // extension label or LZW code size
+    while (p < end && *p)
+      p += *p + 1;
+    p++;
+  }
+  return n;
+}
+
+int main(int argc_, char *argv_[]) {
+  int count = 10;
+  int n = 0;
+  for (int i = 1; i < argc_; i++) {
+    if (!strcmp(argv_[i], "-n") && i + 1 < argc_)
+      count = atoi(argv_[++i]);
+    else if (argv_[i][0] != '-')
+      n++;
+  }
+  if (!n || count <= 0) {
+    fprintf(stderr, "Usage: %s [-n count] files...\n", argv_[0]);
+    exit(0);
+  }
+
+  const long GIF_CTBL = 2 * (1 << 12) * sizeof(uint32_t); // code tables
+  const int max_frames = 10000;
+  Frame *frames = new Frame[max_frames];
+  printf("%-40s %6s %8s %10s %10s %8s %s\n", "file", "frames", "size [K]",
+    "old [MB/s]", "new [MB/s]", "speedup", "check");
+  int errors = 0;
+  for (int i = 1; i < argc_; i++) {
+    if (!strcmp(argv_[i], "-n")) { i++; continue; }
+    if (argv_[i][0] == '-') continue;
+    const char *name = argv_[i];
+    long len = 0;
+    unsigned char *buf = readin(name, len);
+    if (!buf) {
+      printf("%-40s: can't read\n", name);
+      continue;
+    }
+    int nfrm = find_frames(buf, len, frames, max_frames);
+    long cap = 0;
+    long pixels = 0;
+    for (int f = 0; f < nfrm; f++) {
+      if (frames[f].pixels > cap)
+        cap = frames[f].pixels;
+      pixels += frames[f].pixels;
+    }
+    // frame buffers as set up by GIF_Load(): code table, frame, LZW data
+    long dlen = len + 16;
+    uint8_t *mem1 = (uint8_t *)malloc(GIF_CTBL + cap + 2 + dlen);
+    uint8_t *mem2 = (uint8_t *)malloc(GIF_CTBL + cap + 2 + dlen);
+    uint8_t *bptr1 = mem1 + GIF_CTBL;
+    uint8_t *bptr2 = mem2 + GIF_CTBL;
+
+    // check that both decoders give the same results
+    bool same = true;
+    for (int f = 0; f < nfrm && same; f++) {
+      uint8_t *buff1 = frames[f].data, *buff2 = frames[f].data;
+      long size1 = frames[f].size, size2 = frames[f].size;
+      memset(bptr1, 0x5a, cap + 2);
+      memset(bptr2, 0x5a, cap + 2);
+      long ret1 = _GIF_LoadFrame(&buff1, &size1, bptr1, bptr1 + cap);
+      long ret2 = _GIF_LoadFrameFast(&buff2, &size2, bptr2, bptr2 + cap,
+                                     bptr2 + cap + 2, dlen);
+      if (ret1 < 0 || ret2 < 0)
+        same = ret1 < 0 && ret2 < 0; // (the frame is dropped)
+      else
+        same = ret1 == ret2 && buff1 == buff2 && size1 == size2 &&
+               !memcmp(bptr1, bptr2, cap + 2);
+    }
+    if (!same)
+      errors++;
+
+    // time both decoders
+    double t[2];
+    for (int d = 0; d < 2; d++) {
+      double t0 = now();
+      for (int c = 0; c < count; c++) {
+        for (int f = 0; f < nfrm; f++) {
+          uint8_t *buff = frames[f].data;
+          long size = frames[f].size;
+          if (d == 0)
+            _GIF_LoadFrame(&buff, &size, bptr1, bptr1 + cap);
+          else
+            _GIF_LoadFrameFast(&buff, &size, bptr1, bptr1 + cap,
+                               bptr1 + cap + 2, dlen);
+        }
+      }
+      t[d] = (now() - t0) / count;
+    }
+    double mb = pixels / 1000000.;
+    printf("%-40s %6d %8.1f %10.1f %10.1f %8.2f %s\n",
+      name, nfrm, len / 1024., mb / t[0], mb / t[1], t[0] / t[1],
+      same ? "ok" : "DIFFERENT");
+    free(mem1);
+    free(mem2);
+    free(buf);
+  }
+  delete[] frames;
+  return errors ? 1 : 0;
+}